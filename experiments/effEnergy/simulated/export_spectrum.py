@@ -0,0 +1,23 @@
+import spekpy as sp
+import numpy as np
+import sys
+
+# export a binned source spectrum for the ray tracer's polyenergetic mode ("source": {"spectrum": ...})
+# usage: python export_spectrum.py kVp output.csv
+
+# set xray source parameters, same as eff_energy.py
+ang = 14
+filt = 2.5 # mm Al
+z_dist = 44.95 # cm
+
+kvp = float(sys.argv[1]) if len(sys.argv) > 1 else 50
+out_file = sys.argv[2] if len(sys.argv) > 2 else 'spectrum_{:g}kVp.csv'.format(kvp)
+
+s = sp.Spek(kvp = kvp, th = ang, z = z_dist, dk = 1)
+s.filter('Al', filt)
+
+k, phi = s.get_spectrum()
+
+np.savetxt(out_file, np.column_stack((k, phi)), delimiter = ',', fmt = '%.6g',
+           header = 'energy [keV], fluence (spekpy, {:g} kVp, {:g} mm Al)'.format(kvp, filt))
+print('Wrote {} bins to {}, effective energy = {:.2f} keV'.format(len(k), out_file, s.get_eeff()))
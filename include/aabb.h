@@ -0,0 +1,72 @@
+#ifndef AABB_H
+#define AABB_H
+
+#include "utility.h"
+
+#include <algorithm>
+
+class aabb {
+public:
+    aabb() : minimum(infinity, infinity, infinity), maximum(-infinity, -infinity, -infinity) {} // empty box
+    aabb(const vec3& a, const vec3& b) : minimum(a), maximum(b) {}
+
+    vec3 min() const { return minimum; }
+    vec3 max() const { return maximum; }
+
+    void expand(const vec3& p) {
+        for (int a = 0; a < 3; a++) {
+            minimum[a] = std::min(minimum[a], p[a]);
+            maximum[a] = std::max(maximum[a], p[a]);
+        }
+    }
+
+    void expand(const aabb& box) {
+        expand(box.minimum);
+        expand(box.maximum);
+    }
+
+    vec3 centroid() const {
+        return 0.5f * (minimum + maximum);
+    }
+
+    int longest_axis() const {
+        vec3 extent = maximum - minimum;
+        if (extent.x() > extent.y() && extent.x() > extent.z()) return 0;
+        return extent.y() > extent.z() ? 1 : 2;
+    }
+
+    float surface_area() const {
+        vec3 extent = maximum - minimum;
+        return 2.0f * (extent.x() * extent.y() + extent.y() * extent.z() + extent.z() * extent.x());
+    }
+
+    // slab test, inv_dir is the componentwise reciprocal of the ray direction
+    bool hit(const vec3& origin, const vec3& inv_dir, float t_min, float t_max) const {
+        for (int a = 0; a < 3; a++) {
+            float t0 = (minimum[a] - origin[a]) * inv_dir[a];
+            float t1 = (maximum[a] - origin[a]) * inv_dir[a];
+            if (inv_dir[a] < 0.0f) std::swap(t0, t1);
+            t_min = t0 > t_min ? t0 : t_min;
+            t_max = t1 < t_max ? t1 : t_max;
+            if (t_max < t_min) return false;
+        }
+        return true;
+    }
+
+    bool hit(const ray& r, float t_min, float t_max) const {
+        vec3 d = r.direction();
+        return hit(r.origin(), vec3(1.0f / d.x(), 1.0f / d.y(), 1.0f / d.z()), t_min, t_max);
+    }
+
+public:
+    vec3 minimum;
+    vec3 maximum;
+};
+
+inline aabb surrounding_box(const aabb& box0, const aabb& box1) {
+    aabb box = box0;
+    box.expand(box1);
+    return box;
+}
+
+#endif //AABB_H
@@ -0,0 +1,56 @@
+#ifndef ANTIALIASING_H
+#define ANTIALIASING_H
+
+#include "json.h"
+
+#include <algorithm>
+#include <iostream>
+
+using nlohmann::json;
+
+// Pixel area integration, configured by "antialiasing" in the render section:
+//
+// {"samples": 16, "adaptive": true, "contrast": 0.01, "rounds": 4}
+//
+// A pixel becomes the average transmission over its square on the detector, one pixel pitch wide and centred on
+// the point the single ray goes through, instead of the value at that point. Detector points are a Hammersley set
+// with a per-pixel rotation, shared with the focal spot's source points when both are on.
+//
+// In adaptive mode the one ray image is rendered first and only pixels that differ by more than contrast from a
+// 4-neighbour get samples rays, so flat regions keep one ray per pixel. Each further round supersamples the
+// untouched 8-neighbours of every pixel whose value moved by more than contrast, which follows thin structures
+// that only some of the single rays hit. Detail that misses every single ray is not seen, use "adaptive": false
+// to integrate every pixel.
+class antialiasing {
+public:
+    antialiasing() {}
+    explicit antialiasing(const json& config);
+
+    bool enabled() const { return samples > 1; }
+
+    // Detector coordinates (u, v as in camera::get_ray) of sample (s, t) in [0, 1)^2 within pixel (x, y)
+    static void pixel_point(int x, int y, int width, int height, float s, float t, float& u, float& v) {
+        u = (x - 0.5f + s) / (width - 1);
+        v = (height - 1 - y - 0.5f + t) / (height - 1); // framebuffer rows run top to bottom
+    }
+
+public:
+    int samples = 1;
+    bool adaptive = true;
+    float contrast = 0.01f;
+    int rounds = 4;
+};
+
+antialiasing::antialiasing(const json& config) :
+        samples(std::max(1, config.value("samples", config.empty() ? 1 : 16))),
+        adaptive(config.value("adaptive", true)),
+        contrast(config.value("contrast", 0.01f)),
+        rounds(std::max(1, config.value("rounds", 4))) {
+    if (enabled()) {
+        std::cout << "<Anti-aliasing>\n" << samples << " samples per pixel";
+        if (adaptive) std::cout << " where neighbours differ by more than " << contrast << ", " << rounds << " rounds";
+        std::cout << "\n" << std::endl;
+    }
+}
+
+#endif //ANTIALIASING_H
@@ -0,0 +1,99 @@
+#ifndef ATTENUATION_DB_H
+#define ATTENUATION_DB_H
+
+#include "utility.h"
+#include "json.h"
+
+#include <fstream>
+#include <iostream>
+#include <mutex>
+
+using nlohmann::json;
+
+// Elemental mass attenuation coefficients from the NIST tables in nist_mu.dat. The file is parsed once per
+// process, on first use, into flat energy and mu/rho arrays shared by every material.
+class attenuation_database {
+public:
+    // Sets the data file location, must be called before the first instance() to have an effect
+    static void set_path(const string& path);
+    static const attenuation_database& instance();
+
+    int num_elements() const { return static_cast<int>(offsets.size()) - 1; }
+    bool has_element(int atomic_number) const { return atomic_number >= 1 && atomic_number <= num_elements(); }
+
+    // Tabulated points of element Z: photon energy [MeV] and mu/rho [cm^2/g]
+    size_t num_points(int atomic_number) const { return offsets[atomic_number] - offsets[atomic_number - 1]; }
+    const float* energies(int atomic_number) const { return &energy[offsets[atomic_number - 1]]; }
+    const float* mu_over_rho(int atomic_number) const { return &mu[offsets[atomic_number - 1]]; }
+
+    // mu/rho of element Z at photon energy e [MeV], linearly interpolated between the tabulated points
+    float mu_over_rho_at(int atomic_number, float e) const {
+        return interpolate(energies(atomic_number), mu_over_rho(atomic_number), num_points(atomic_number), e);
+    }
+
+private:
+    std::vector<float> energy;
+    std::vector<float> mu;
+    std::vector<size_t> offsets; // element Z occupies [offsets[Z-1], offsets[Z]) of energy and mu
+
+    attenuation_database() {}
+    void load(const string& path);
+
+    static string& data_path() {
+        static string path = "materials/nist_mu.dat";
+        return path;
+    }
+    static std::mutex& path_lock() {
+        static std::mutex lock;
+        return lock;
+    }
+};
+
+void attenuation_database::set_path(const string& path) {
+    std::lock_guard<std::mutex> guard(path_lock());
+    data_path() = path;
+}
+
+const attenuation_database& attenuation_database::instance() {
+    static attenuation_database db;
+    static std::once_flag loaded;
+    std::call_once(loaded, [] {
+        string path;
+        {
+            std::lock_guard<std::mutex> guard(path_lock());
+            path = data_path();
+        }
+        db.load(path);
+    });
+    return db;
+}
+
+void attenuation_database::load(const string& path) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Error opening attenuation data file " << path << std::endl;
+        exit(1);
+    }
+
+    json j;
+    try {
+        j = json::parse(file);
+    } catch (json::parse_error& e) {
+        std::cerr << "Failed to parse file " << path << ": " << e.what() << std::endl;
+        exit(1);
+    }
+
+    const json &photon_energy = j["photon energy"];
+    const json &mu_over_rho = j["mu_over_rho"];
+    offsets.push_back(0);
+    for (int i = 0; i < photon_energy.size(); i++) {
+        for (int k = 0; k < photon_energy[i].size(); k++) {
+            energy.push_back(photon_energy[i][k].get<float>());
+            mu.push_back(mu_over_rho[i][k].get<float>());
+        }
+        offsets.push_back(energy.size());
+    }
+    std::cout << "<Attenuation Data>\nLoaded " << num_elements() << " elements from " << path << "\n" << std::endl;
+}
+
+#endif //ATTENUATION_DB_H
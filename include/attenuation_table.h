@@ -0,0 +1,252 @@
+#ifndef ATTENUATION_TABLE_H
+#define ATTENUATION_TABLE_H
+
+#include "attenuation_db.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#if defined(__AVX2__) && !defined(XRT_NO_SIMD)
+#include <immintrin.h>
+#endif
+
+// mu/rho(E) of a mixture resampled onto a uniform grid in log energy, so a lookup is one index computation and
+// a log-log interpolation instead of a search through every element's NIST table. Absorption edges fall
+// between grid points, so each edge is kept exactly with its values just below and above it, and lookups in
+// a cell holding an edge interpolate on the correct side of it. Energies in MeV, mu/rho in cm^2/g.
+class attenuation_table {
+public:
+    static const int points_per_decade = 512;
+
+    attenuation_table() {}
+
+    // composition: (atomic number, weight fraction) pairs
+    void build(const std::vector<std::pair<int, float>>& composition);
+
+    bool empty() const { return log_mu.empty(); }
+
+    float mu_over_rho(float e) const;
+
+    // mu_over_rho() of n energies, 8 per instruction with AVX2
+    void mu_over_rho(const float* e, float* out, size_t n) const;
+
+private:
+    struct absorption_edge {
+        float x;        // position in grid units
+        float below;    // log mu/rho just below the edge
+        float above;    // log mu/rho at and above it
+    };
+
+    float log_e_min = 0;
+    float inv_step = 1;           // grid points per unit of log E
+    std::vector<float> log_mu;    // log mu/rho at the grid points
+    std::vector<int> cell_edges;  // edges of cell i are edges[cell_edges[i]] .. edges[cell_edges[i + 1] - 1]
+    std::vector<absorption_edge> edges;
+
+    // Position of energy e in grid units, and log mu/rho there
+    float grid_x(float e) const { return (std::log(e) - log_e_min) * inv_step; }
+    float lookup_log(float x) const;
+
+    // One element's tabulated points as log E, log mu/rho, edges being two points at the same energy
+    struct element_curve {
+        std::vector<double> x, y;
+        std::vector<double> edge_energies;
+        double eval(double e, bool below_edge) const;
+    };
+    static element_curve element(int atomic_number);
+
+#if defined(__AVX2__) && !defined(XRT_NO_SIMD)
+    static __m256 log256(__m256 x);
+    static __m256 exp256(__m256 x);
+#endif
+};
+
+attenuation_table::element_curve attenuation_table::element(int atomic_number) {
+    const attenuation_database &db = attenuation_database::instance();
+    const float *e = db.energies(atomic_number);
+    const float *mu = db.mu_over_rho(atomic_number);
+    const double edge_gap = 2.5e-6; // NIST lists an edge as two energies 1 eV apart
+
+    element_curve curve;
+    double last_e = 0, last_mu = 0;
+    for (size_t i = 0; i < db.num_points(atomic_number); i++) {
+        if (i > 0 && e[i] < last_e + edge_gap) {
+            // repeated energy: a jump up is an absorption edge at last_e, anything else is a duplicate point
+            bool already_edge = curve.x.size() >= 2 && curve.x[curve.x.size() - 2] == curve.x.back();
+            if (mu[i] > last_mu && !already_edge) {
+                curve.x.push_back(std::log(last_e));
+                curve.y.push_back(std::log(static_cast<double>(mu[i])));
+                curve.edge_energies.push_back(last_e);
+                last_mu = mu[i];
+            }
+            continue;
+        }
+        last_e = e[i];
+        last_mu = mu[i];
+        curve.x.push_back(std::log(last_e));
+        curve.y.push_back(std::log(last_mu));
+    }
+    return curve;
+}
+
+double attenuation_table::element_curve::eval(double e, bool below_edge) const {
+    double lx = std::log(e);
+    // segment i .. i + 1 containing lx, at an edge the left one when below_edge
+    size_t i = below_edge ? std::lower_bound(x.begin(), x.end(), lx) - x.begin()
+                          : std::upper_bound(x.begin(), x.end(), lx) - x.begin();
+    i = i > 0 ? i - 1 : 0;
+    if (i > x.size() - 2) i = x.size() - 2;
+    if (x[i + 1] == x[i]) return below_edge ? y[i] : y[i + 1];
+    return y[i] + (lx - x[i]) * (y[i + 1] - y[i]) / (x[i + 1] - x[i]);
+}
+
+void attenuation_table::build(const std::vector<std::pair<int, float>>& composition) {
+    std::vector<element_curve> curves;
+    double e_min = 0, e_max = 0;
+    std::vector<double> edge_energies;
+    for (const auto &element_weight: composition) {
+        curves.push_back(element(element_weight.first));
+        const element_curve &c = curves.back();
+        double lo = std::exp(c.x.front()), hi = std::exp(c.x.back());
+        e_min = curves.size() == 1 ? lo : std::min(e_min, lo);
+        e_max = curves.size() == 1 ? hi : std::max(e_max, hi);
+        edge_energies.insert(edge_energies.end(), c.edge_energies.begin(), c.edge_energies.end());
+    }
+    std::sort(edge_energies.begin(), edge_energies.end());
+    edge_energies.erase(std::unique(edge_energies.begin(), edge_energies.end()), edge_energies.end());
+
+    auto mixture = [&](double e, bool below_edge) {
+        double mu = 0;
+        for (size_t k = 0; k < curves.size(); k++) {
+            mu += composition[k].second * std::exp(curves[k].eval(e, below_edge));
+        }
+        return std::log(mu);
+    };
+
+    double log_min = std::log(e_min), log_max = std::log(e_max);
+    int points = static_cast<int>(std::ceil((log_max - log_min) / std::log(10.0) * points_per_decade)) + 1;
+    double step = (log_max - log_min) / (points - 1);
+    log_e_min = static_cast<float>(log_min);
+    inv_step = static_cast<float>(1 / step);
+
+    log_mu.resize(points);
+    for (int i = 0; i < points; i++) {
+        log_mu[i] = static_cast<float>(mixture(std::exp(log_min + i * step), false));
+    }
+
+    edges.clear();
+    cell_edges.assign(points, 0);
+    for (double e: edge_energies) {
+        double x = (std::log(e) - log_min) / step;
+        if (x <= 0 || x >= points - 1) continue;
+        edges.push_back({static_cast<float>(x), static_cast<float>(mixture(e, true)),
+                         static_cast<float>(mixture(e, false))});
+        cell_edges[static_cast<int>(x) + 1]++;
+    }
+    for (int i = 1; i < points; i++) cell_edges[i] += cell_edges[i - 1]; // counts to offsets
+}
+
+float attenuation_table::lookup_log(float x) const {
+    const int cells = static_cast<int>(log_mu.size()) - 1;
+    int i = static_cast<int>(std::floor(x));
+    i = std::max(0, std::min(cells - 1, i)); // outside the grid the end cells extrapolate
+
+    float left_x = static_cast<float>(i), left_y = log_mu[i];
+    for (int k = cell_edges[i]; k < cell_edges[i + 1]; k++) {
+        const absorption_edge &edge = edges[k];
+        if (x < edge.x) return left_y + (x - left_x) * (edge.below - left_y) / (edge.x - left_x);
+        left_x = edge.x;
+        left_y = edge.above;
+    }
+    float right_x = static_cast<float>(i + 1);
+    return left_y + (x - left_x) * (log_mu[i + 1] - left_y) / (right_x - left_x);
+}
+
+float attenuation_table::mu_over_rho(float e) const {
+    return std::exp(lookup_log(grid_x(e)));
+}
+
+void attenuation_table::mu_over_rho(const float* e, float* out, size_t n) const {
+    size_t k = 0;
+#if defined(__AVX2__) && !defined(XRT_NO_SIMD)
+    const int cells = static_cast<int>(log_mu.size()) - 1;
+    const __m256 offset = _mm256_set1_ps(log_e_min), scale = _mm256_set1_ps(inv_step);
+    const __m256i last_cell = _mm256_set1_epi32(cells - 1), one = _mm256_set1_epi32(1);
+    for (; k + 8 <= n; k += 8) {
+        __m256 x = _mm256_mul_ps(_mm256_sub_ps(log256(_mm256_loadu_ps(e + k)), offset), scale);
+        __m256i i = _mm256_cvttps_epi32(_mm256_floor_ps(x));
+        i = _mm256_max_epi32(_mm256_setzero_si256(), _mm256_min_epi32(last_cell, i));
+        __m256i next = _mm256_add_epi32(i, one);
+
+        __m256 y0 = _mm256_i32gather_ps(log_mu.data(), i, 4);
+        __m256 y1 = _mm256_i32gather_ps(log_mu.data(), next, 4);
+        __m256 t = _mm256_sub_ps(x, _mm256_cvtepi32_ps(i));
+        _mm256_storeu_ps(out + k, exp256(_mm256_add_ps(y0, _mm256_mul_ps(t, _mm256_sub_ps(y1, y0)))));
+
+        // cells holding an edge are redone one at a time
+        __m256i edges_before = _mm256_i32gather_epi32(cell_edges.data(), i, 4);
+        __m256i edges_after = _mm256_i32gather_epi32(cell_edges.data(), next, 4);
+        unsigned edge_lanes = ~_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(edges_before, edges_after))) & 0xFF;
+        for (; edge_lanes; edge_lanes &= edge_lanes - 1) {
+            int lane = __builtin_ctz(edge_lanes);
+            out[k + lane] = mu_over_rho(e[k + lane]);
+        }
+    }
+#endif
+    for (; k < n; k++) {
+        out[k] = mu_over_rho(e[k]);
+    }
+}
+
+#if defined(__AVX2__) && !defined(XRT_NO_SIMD)
+// Cephes logf for positive normal x
+__m256 attenuation_table::log256(__m256 x) {
+    __m256i bits = _mm256_castps_si256(x);
+    __m256 exponent = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(0x7e)));
+    // mantissa in [0.5, 1)
+    x = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x807FFFFF)),
+                                            _mm256_set1_epi32(0x3F000000)));
+
+    __m256 small = _mm256_cmp_ps(x, _mm256_set1_ps(0.707106781186547524f), _CMP_LT_OQ);
+    exponent = _mm256_sub_ps(exponent, _mm256_and_ps(_mm256_set1_ps(1.0f), small));
+    x = _mm256_add_ps(_mm256_sub_ps(x, _mm256_set1_ps(1.0f)), _mm256_and_ps(x, small));
+
+    const float p[] = {7.0376836292e-2f, -1.1514610310e-1f, 1.1676998740e-1f, -1.2420140846e-1f, 1.4249322787e-1f,
+                       -1.6668057665e-1f, 2.0000714765e-1f, -2.4999993993e-1f, 3.3333331174e-1f};
+    __m256 z = _mm256_mul_ps(x, x);
+    __m256 y = _mm256_set1_ps(p[0]);
+    for (int k = 1; k < 9; k++) y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(p[k]));
+    y = _mm256_mul_ps(_mm256_mul_ps(y, x), z);
+    y = _mm256_add_ps(y, _mm256_mul_ps(exponent, _mm256_set1_ps(-2.12194440e-4f)));
+    y = _mm256_sub_ps(y, _mm256_mul_ps(z, _mm256_set1_ps(0.5f)));
+    x = _mm256_add_ps(x, y);
+    return _mm256_add_ps(x, _mm256_mul_ps(exponent, _mm256_set1_ps(0.693359375f)));
+}
+
+// Cephes expf
+__m256 attenuation_table::exp256(__m256 x) {
+    x = _mm256_min_ps(x, _mm256_set1_ps(88.3762626647949f));
+    x = _mm256_max_ps(x, _mm256_set1_ps(-88.3762626647949f));
+
+    __m256 fx = _mm256_floor_ps(_mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(1.44269504088896341f)),
+                                              _mm256_set1_ps(0.5f)));
+    x = _mm256_sub_ps(x, _mm256_mul_ps(fx, _mm256_set1_ps(0.693359375f)));
+    x = _mm256_sub_ps(x, _mm256_mul_ps(fx, _mm256_set1_ps(-2.12194440e-4f)));
+
+    const float p[] = {1.9875691500e-4f, 1.3981999507e-3f, 8.3334519073e-3f, 4.1665795894e-2f, 1.6666665459e-1f,
+                       5.0000001201e-1f};
+    __m256 z = _mm256_mul_ps(x, x);
+    __m256 y = _mm256_set1_ps(p[0]);
+    for (int k = 1; k < 6; k++) y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(p[k]));
+    y = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(y, z), x), _mm256_set1_ps(1.0f));
+
+    __m256i power = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvttps_epi32(fx), _mm256_set1_epi32(0x7f)), 23);
+    return _mm256_mul_ps(y, _mm256_castsi256_ps(power));
+}
+#endif
+
+#endif //ATTENUATION_TABLE_H
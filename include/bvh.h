@@ -0,0 +1,442 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "aabb.h"
+#include "ray_packet.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <vector>
+
+struct bvh_node {
+    aabb box;
+    int left_first; // index of the left child (right child is left_first + 1), or of the first primitive in a leaf
+    int count;      // number of primitives in a leaf, 0 for interior nodes
+};
+
+// Shape and build cost of a tree, see bvh::statistics()
+struct bvh_stats {
+    double build_seconds = 0;
+    size_t nodes = 0;
+    size_t leaves = 0;
+    int depth = 0;       // levels below the root
+    float sah_cost = 0;  // expected box and primitive tests of a ray crossing the root box
+};
+
+// Bounding volume hierarchy over a list of primitive boxes. Primitives are referred to by their index in the
+// list passed to build(), the owner keeps the primitives themselves.
+//
+// Nodes are split with the surface area heuristic over sah_bins centroid bins per axis. Nodes of more than
+// subtree_size primitives are split first, binning on several threads, then the subtrees below them are built
+// as separate tasks and appended in order, so the tree is the same for any number of threads.
+class bvh {
+public:
+    bvh() {}
+    bvh(const std::vector<aabb>& prim_boxes) { build(prim_boxes); }
+
+    // Threads for large builds, 0 uses every hardware thread
+    static void set_build_threads(int threads) { build_threads() = threads; }
+
+    void build(const std::vector<aabb>& prim_boxes);
+
+    // Same tree as build(prim_boxes) without the box list, box_of(i) returns the box of primitive i and is called
+    // once per primitive, from several threads.
+    template<typename F>
+    void build(size_t count, F&& box_of);
+
+    void translate(const vec3& offset) {
+        for (auto &node: nodes) {
+            node.box = aabb(node.box.min() + offset, node.box.max() + offset);
+        }
+    }
+
+    bool empty() const { return nodes.empty(); }
+    aabb bounds() const { return nodes.empty() ? aabb() : nodes[0].box; }
+
+    // Node count, depth and SAH cost of the tree, with the time of the last build()
+    bvh_stats statistics() const;
+
+    // Calls visit(prim) for every primitive in every leaf whose box is crossed by the ray within [t_min, t_max].
+    // All crossed leaves are visited, so callers collecting every intersection along the ray get all of them.
+    template<typename F>
+    void traverse(const ray& r, float t_min, float t_max, F&& visit) const;
+
+    // Same walk as traverse(), but calls visit(first, count) once per crossed leaf with its range in prim_indices
+    template<typename F>
+    void traverse_leaves(const ray& r, float t_min, float t_max, F&& visit) const;
+
+    // Packet version of traverse_leaves(): calls visit(first, count, mask) per crossed leaf with the rays of the
+    // packet that cross it. Node boxes are tested once for the whole packet, and once fewer than
+    // min_packet_rays rays are left in a subtree they finish it one by one, each with a single bit mask.
+    template<typename F>
+    void traverse_packet(const ray_packet& packet, float t_min, float t_max, F&& visit) const;
+
+public:
+    std::vector<bvh_node> nodes;
+    std::vector<int> prim_indices; // primitive indices in leaf order
+    double build_seconds = 0;
+
+private:
+    static const int max_leaf_size = 4;
+    static const int max_depth = 64;
+    static const int min_packet_rays = 4;
+
+    static const int sah_bins = 16;
+    static const int subtree_size = 4096;        // nodes up to this size are built as one task
+    static const int parallel_bin_size = 65536;  // nodes from this size are binned on several threads
+    static const int block_size = 16384;         // primitives per binning job
+    static constexpr float traversal_cost = 1, intersection_cost = 1;
+
+    // box of a bin, padded to four lanes so the compiler turns expand() into vector min and max
+    struct bin_box {
+        float min[4] = {float(infinity), float(infinity), float(infinity), 0};
+        float max[4] = {-float(infinity), -float(infinity), -float(infinity), 0};
+
+        bin_box() {}
+        explicit bin_box(const aabb& box) :
+                min{box.minimum[0], box.minimum[1], box.minimum[2], 0},
+                max{box.maximum[0], box.maximum[1], box.maximum[2], 0} {}
+
+        void expand(const bin_box& other) {
+            for (int k = 0; k < 4; k++) {
+                min[k] = std::min(min[k], other.min[k]);
+                max[k] = std::max(max[k], other.max[k]);
+            }
+        }
+        float surface_area() const {
+            float x = max[0] - min[0], y = max[1] - min[1], z = max[2] - min[2];
+            return 2 * (x * y + y * z + z * x);
+        }
+        aabb to_aabb() const { return aabb(vec3(min[0], min[1], min[2]), vec3(max[0], max[1], max[2])); }
+    };
+
+    // primitives whose centroids fall into one bin, or a range of bins
+    struct sah_bin {
+        bin_box box;
+        int count = 0;
+
+        void add(const sah_bin& other) {
+            box.expand(other.box);
+            count += other.count;
+        }
+    };
+
+    struct sah_binning {
+        sah_bin bins[3][sah_bins]; // per axis
+    };
+
+    // what the build keeps of a primitive, moved with it by every split so each node's primitives are contiguous
+    struct prim_ref {
+        aabb box;
+        int index;
+    };
+
+    // a node whose primitives and bounds are known but which is not split yet
+    struct pending_node {
+        int index;
+        aabb box, centroid_box;
+        int depth;
+    };
+
+    static int& build_threads() {
+        static int threads = 0;
+        return threads;
+    }
+
+    template<typename F>
+    void traverse_leaves_from(int root, const vec3& origin, const vec3& inv_dir, float t_min, float t_max,
+                              F&& visit) const;
+
+    // Splits node down to its leaves into out. With deferred given, nodes of up to subtree_size primitives are
+    // added to it instead.
+    static void subdivide(std::vector<bvh_node>& out, const pending_node& node, std::vector<prim_ref>& refs,
+                          thread_pool* pool, std::vector<pending_node>* deferred);
+};
+
+void bvh::build(const std::vector<aabb>& prim_boxes) {
+    build(prim_boxes.size(), [&](int i) { return prim_boxes[i]; });
+}
+
+template<typename F>
+void bvh::build(size_t count, F&& box_of) {
+    auto start = std::chrono::steady_clock::now();
+    nodes.clear();
+    prim_indices.clear();
+    build_seconds = 0;
+    if (count == 0) return;
+
+    std::unique_ptr<thread_pool> pool;
+    if (count > subtree_size && build_threads() != 1) pool = std::make_unique<thread_pool>(build_threads());
+    auto parallel_for = [&](size_t jobs, const std::function<void(size_t, int)>& job) {
+        if (pool) pool->parallel_for(jobs, job);
+        else for (size_t i = 0; i < jobs; i++) job(i, 0);
+    };
+
+    // primitive boxes and the root bounds, a block of primitives per job
+    std::vector<prim_ref> refs(count);
+    size_t blocks = (count + block_size - 1) / block_size;
+    std::vector<pending_node> block_bounds(blocks);
+    parallel_for(blocks, [&](size_t block, int) {
+        pending_node &bounds = block_bounds[block];
+        for (size_t i = block * block_size; i < std::min(count, (block + 1) * block_size); i++) {
+            refs[i] = {box_of(i), static_cast<int>(i)};
+            bounds.box.expand(refs[i].box);
+            bounds.centroid_box.expand(refs[i].box.centroid());
+        }
+    });
+    pending_node root = {0, aabb(), aabb(), 0};
+    for (const pending_node &bounds: block_bounds) {
+        root.box.expand(bounds.box);
+        root.centroid_box.expand(bounds.centroid_box);
+    }
+
+    // top levels here, the subtrees below them in parallel, each into its own array
+    nodes.reserve(2 * count);
+    nodes.push_back({aabb(), 0, static_cast<int>(count)});
+    std::vector<pending_node> subtrees;
+    subdivide(nodes, root, refs, pool.get(), &subtrees);
+
+    std::vector<std::vector<bvh_node>> subtree_nodes(subtrees.size());
+    parallel_for(subtrees.size(), [&](size_t k, int) {
+        std::vector<bvh_node> &out = subtree_nodes[k];
+        out.reserve(2 * nodes[subtrees[k].index].count);
+        out.push_back(nodes[subtrees[k].index]);
+        pending_node subtree = subtrees[k];
+        subtree.index = 0;
+        subdivide(out, subtree, refs, nullptr, nullptr);
+    });
+    prim_indices.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        prim_indices[i] = refs[i].index;
+    }
+    std::vector<prim_ref>().swap(refs);
+
+    // append the subtrees in order, the root of each replaces its placeholder
+    for (size_t k = 0; k < subtrees.size(); k++) {
+        int offset = static_cast<int>(nodes.size()) - 1;
+        for (size_t i = 0; i < subtree_nodes[k].size(); i++) {
+            bvh_node node = subtree_nodes[k][i];
+            if (node.count == 0) node.left_first += offset;
+            if (i == 0) nodes[subtrees[k].index] = node;
+            else nodes.push_back(node);
+        }
+        std::vector<bvh_node>().swap(subtree_nodes[k]);
+    }
+    build_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void bvh::subdivide(std::vector<bvh_node>& out, const pending_node& node, std::vector<prim_ref>& refs,
+                    thread_pool* pool, std::vector<pending_node>* deferred) {
+    int first = out[node.index].left_first;
+    int count = out[node.index].count;
+    out[node.index].box = node.box;
+
+    if (count <= max_leaf_size || node.depth >= max_depth) return; // small enough to be a leaf
+    vec3 extent = node.centroid_box.max() - node.centroid_box.min();
+    if (extent.x() <= 0 && extent.y() <= 0 && extent.z() <= 0) return; // all centroids coincide, no useful split
+    if (deferred && count <= subtree_size) {
+        deferred->push_back(node);
+        return;
+    }
+
+    // bin the centroids along every axis, large nodes a block of primitives per thread. Small nodes get one bin
+    // per primitive, as more would mostly be empty.
+    int num_bins = std::min(count, int(sah_bins));
+    vec3 origin = node.centroid_box.min(), scale;
+    for (int axis = 0; axis < 3; axis++) {
+        scale[axis] = extent[axis] > 0 ? num_bins * (1 - 1e-6f) / extent[axis] : 0;
+    }
+    auto bin_of = [&](const vec3& centroid, int axis) {
+        int bin = static_cast<int>((centroid[axis] - origin[axis]) * scale[axis]);
+        return std::min(std::max(bin, 0), num_bins - 1);
+    };
+    auto bin_range = [&](int begin, int end, sah_binning& binning) {
+        for (int i = begin; i < end; i++) {
+            bin_box box(refs[i].box);
+            vec3 centroid = refs[i].box.centroid();
+            for (int axis = 0; axis < 3; axis++) {
+                sah_bin &bin = binning.bins[axis][bin_of(centroid, axis)];
+                bin.box.expand(box);
+                bin.count++;
+            }
+        }
+    };
+
+    sah_binning binning;
+    if (pool && count >= parallel_bin_size) {
+        int blocks = (count + block_size - 1) / block_size;
+        std::vector<sah_binning> block_binnings(blocks);
+        pool->parallel_for(blocks, [&](size_t block, int) {
+            int begin = first + static_cast<int>(block) * block_size;
+            bin_range(begin, std::min(first + count, begin + block_size), block_binnings[block]);
+        });
+        for (const sah_binning &block: block_binnings) {
+            for (int axis = 0; axis < 3; axis++) {
+                for (int b = 0; b < num_bins; b++) binning.bins[axis][b].add(block.bins[axis][b]);
+            }
+        }
+    }
+    else {
+        bin_range(first, first + count, binning);
+    }
+    auto &bins = binning.bins;
+
+    // sweep the bins from the right, then from the left, for the cheapest split A_left N_left + A_right N_right
+    float best_cost = infinity;
+    int best_axis = -1, best_split = 0;
+    for (int axis = 0; axis < 3; axis++) {
+        if (scale[axis] == 0) continue;
+        float right_cost[sah_bins];
+        sah_bin right;
+        for (int b = num_bins - 1; b > 0; b--) {
+            right.add(bins[axis][b]);
+            right_cost[b] = right.count ? right.box.surface_area() * right.count : 0;
+        }
+        sah_bin left;
+        for (int split = 1; split < num_bins; split++) {
+            left.add(bins[axis][split - 1]);
+            if (left.count == 0 || left.count == count) continue;
+            float cost = left.box.surface_area() * left.count + right_cost[split];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_split = split;
+            }
+        }
+    }
+    if (best_axis < 0) return; // cannot happen while the centroids span some bins, but stay a leaf if it does
+
+    // partition around the split, collecting the centroid bounds of both sides on the way
+    sah_bin left, right;
+    for (int b = 0; b < num_bins; b++) (b < best_split ? left : right).add(bins[best_axis][b]);
+    aabb left_centroids, right_centroids;
+    int i = first, j = first + count - 1;
+    while (true) {
+        for (vec3 c; i <= j && bin_of(c = refs[i].box.centroid(), best_axis) < best_split; i++) {
+            left_centroids.expand(c);
+        }
+        for (vec3 c; i <= j && bin_of(c = refs[j].box.centroid(), best_axis) >= best_split; j--) {
+            right_centroids.expand(c);
+        }
+        if (i > j) break;
+        std::swap(refs[i], refs[j]);
+    }
+
+    int left_index = static_cast<int>(out.size());
+    out.push_back({aabb(), first, left.count});
+    out.push_back({aabb(), first + left.count, right.count});
+    out[node.index].left_first = left_index;
+    out[node.index].count = 0;
+
+    subdivide(out, {left_index, left.box.to_aabb(), left_centroids, node.depth + 1}, refs, pool, deferred);
+    subdivide(out, {left_index + 1, right.box.to_aabb(), right_centroids, node.depth + 1}, refs, pool, deferred);
+}
+
+bvh_stats bvh::statistics() const {
+    bvh_stats stats;
+    stats.build_seconds = build_seconds;
+    stats.nodes = nodes.size();
+    if (nodes.empty()) return stats;
+
+    // cost of a node is its surface area relative to the root's times the tests made once a ray reaches it
+    float root_area = nodes[0].box.surface_area();
+    std::vector<std::pair<int, int>> stack = {{0, 0}};
+    while (!stack.empty()) {
+        auto [index, depth] = stack.back();
+        stack.pop_back();
+        const bvh_node &node = nodes[index];
+        stats.depth = std::max(stats.depth, depth);
+        float area = root_area > 0 ? node.box.surface_area() / root_area : 1;
+        if (node.count > 0) {
+            stats.leaves++;
+            stats.sah_cost += area * node.count * intersection_cost;
+        }
+        else {
+            stats.sah_cost += area * 2 * traversal_cost; // both child boxes are tested
+            stack.push_back({node.left_first, depth + 1});
+            stack.push_back({node.left_first + 1, depth + 1});
+        }
+    }
+    return stats;
+}
+
+template<typename F>
+void bvh::traverse(const ray& r, float t_min, float t_max, F&& visit) const {
+    traverse_leaves(r, t_min, t_max, [&](int first, int count) {
+        for (int i = first; i < first + count; i++) {
+            visit(prim_indices[i]);
+        }
+    });
+}
+
+template<typename F>
+void bvh::traverse_leaves(const ray& r, float t_min, float t_max, F&& visit) const {
+    if (nodes.empty()) return;
+
+    vec3 d = r.direction();
+    traverse_leaves_from(0, r.origin(), vec3(1.0f / d.x(), 1.0f / d.y(), 1.0f / d.z()), t_min, t_max, visit);
+}
+
+template<typename F>
+void bvh::traverse_leaves_from(int root, const vec3& origin, const vec3& inv_dir, float t_min, float t_max,
+                               F&& visit) const {
+    int stack[max_depth + 2];
+    int stack_size = 0;
+    stack[stack_size++] = root;
+
+    while (stack_size > 0) {
+        const bvh_node& node = nodes[stack[--stack_size]];
+        if (!node.box.hit(origin, inv_dir, t_min, t_max)) continue;
+
+        if (node.count > 0) {
+            visit(node.left_first, node.count);
+        }
+        else {
+            stack[stack_size++] = node.left_first;
+            stack[stack_size++] = node.left_first + 1;
+        }
+    }
+}
+
+template<typename F>
+void bvh::traverse_packet(const ray_packet& packet, float t_min, float t_max, F&& visit) const {
+    if (nodes.empty() || packet.size == 0) return;
+
+    struct entry { int node; uint64_t mask; };
+    entry stack[max_depth + 2];
+    int stack_size = 0;
+    stack[stack_size++] = {0, packet.all()};
+
+    while (stack_size > 0) {
+        entry e = stack[--stack_size];
+        const bvh_node& node = nodes[e.node];
+
+        if (__builtin_popcountll(e.mask) < min_packet_rays) {
+            // the packet has diverged, trace what is left of it as single rays
+            for (uint64_t mask = e.mask; mask; mask &= mask - 1) {
+                int i = __builtin_ctzll(mask);
+                vec3 inv_dir(packet.ix[i], packet.iy[i], packet.iz[i]);
+                traverse_leaves_from(e.node, packet.rays[i].orig, inv_dir, t_min, t_max, [&](int first, int count) {
+                    visit(first, count, uint64_t(1) << i);
+                });
+            }
+            continue;
+        }
+
+        uint64_t mask = box_hit_packet(node.box, packet, e.mask, t_min, t_max);
+        if (!mask) continue;
+
+        if (node.count > 0) {
+            visit(node.left_first, node.count, mask);
+        }
+        else {
+            stack[stack_size++] = {node.left_first, mask};
+            stack[stack_size++] = {node.left_first + 1, mask};
+        }
+    }
+}
+
+#endif //BVH_H
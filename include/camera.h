@@ -1,6 +1,7 @@
 #ifndef CAMERA_H
 #define CAMERA_H
 
+#include "aabb.h"
 #include "utility.h"
 
 class camera {
@@ -18,8 +19,77 @@ public:
 
 
     }
+
+    // Source at position looking towards look_at, the detector is focal_length away and its vertical edge
+    // follows up. The default pose (origin, looking down -z, y up) gives the camera above.
+    camera(float viewport_width, float aspect_ratio, float focal_length, const vec3& position, const vec3& look_at,
+           const vec3& up) {
+        float viewport_height = viewport_width / aspect_ratio;
+
+        vec3 w = unit_vector(position - look_at);
+        vec3 u = unit_vector(cross(up, w));
+        vec3 v = cross(w, u);
+
+        origin = position;
+        horizontal = viewport_width * u;
+        vertical = viewport_height * v;
+        lower_left_corner = origin - horizontal/2 - vertical/2 - focal_length * w;
+    }
+
     ray get_ray(float u, float v) const {
-        return ray(origin, lower_left_corner + u*horizontal + v*vertical);
+        return ray(origin, lower_left_corner + u*horizontal + v*vertical - origin);
+    }
+
+    // Ray to the same detector point from a source point moved by (source_x, source_y) [cm] along the detector's
+    // horizontal and vertical, for a finite focal spot
+    ray get_ray(float u, float v, float source_x, float source_y) const {
+        vec3 s = origin + source_x * unit_vector(horizontal) + source_y * unit_vector(vertical);
+        return ray(s, lower_left_corner + u*horizontal + v*vertical - s);
+    }
+
+    const vec3& source() const { return origin; }
+
+    // Width [cm] of the detector, horizontally
+    float detector_width() const { return horizontal.length(); }
+
+    // Largest blur [cm] on the detector from a source spread over width, for objects inside box. A point at depth
+    // d from the source along the axis magnifies the spot by (F - d) / d, F the source to detector distance.
+    float penumbra(const aabb& box, float width) const {
+        vec3 axis = lower_left_corner + horizontal/2 + vertical/2 - origin;
+        float f = axis.length();
+        axis /= f;
+        float nearest = f;
+        for (int corner = 0; corner < 8; corner++) {
+            vec3 p(corner & 1 ? box.max().x() : box.min().x(),
+                   corner & 2 ? box.max().y() : box.min().y(),
+                   corner & 4 ? box.max().z() : box.min().z());
+            nearest = std::min(nearest, dot(p - origin, axis));
+        }
+        nearest = std::max(nearest, 0.01f * f); // objects around the source
+        return width * (f - nearest) / nearest;
+    }
+
+    // Detector coordinates (u, v as in get_ray) where the line from p along dir meets the detector plane, false
+    // if it is travelling away from it
+    bool detector_coordinates(const vec3& p, const vec3& dir, float& u, float& v) const {
+        vec3 normal = cross(horizontal, vertical);
+        float t = dot(lower_left_corner - p, normal) / dot(dir, normal);
+        if (!(t > 0)) return false;
+        vec3 on_detector = p + t * dir - lower_left_corner;
+        u = dot(on_detector, horizontal) / horizontal.length_squared();
+        v = dot(on_detector, vertical) / vertical.length_squared();
+        return true;
+    }
+
+    // Source and detector turned together by angle radians about an axis through center, like a gantry
+    camera rotated(const vec3& axis, float angle, const vec3& center) const {
+        camera c;
+        vec3 a = unit_vector(axis);
+        c.origin = rotate(origin - center, a, angle) + center;
+        c.lower_left_corner = rotate(lower_left_corner - center, a, angle) + center;
+        c.horizontal = rotate(horizontal, a, angle);
+        c.vertical = rotate(vertical, a, angle);
+        return c;
     }
 private:
     vec3 origin;
@@ -10,9 +10,16 @@
 #include <iostream>
 #include <fstream>
 
+// Translates a transmitted intensity to a grey level in [0, max_value], dark where the beam is unattenuated
+inline int grey_level(float intensity, int max_value) {
+    if (intensity < 0) intensity = 0;
+    if (intensity > 1) intensity = 1;
+    return static_cast<int>((max_value + 0.999) * (1.0-intensity));
+}
+
 void write_color(std::ofstream &file, float intensity) {
     // Write the translated [0,255] value of pixel intensity
-          file << static_cast<int>(255.999 * (1.0-intensity)) << '\n';
+          file << grey_level(intensity, 255) << '\n';
 }
 
 #endif //COLOR_H
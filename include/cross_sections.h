@@ -0,0 +1,173 @@
+#ifndef CROSS_SECTIONS_H
+#define CROSS_SECTIONS_H
+
+#include "utility.h"
+
+#include <iostream>
+#include <utility>
+
+// Partial mass attenuation coefficients of a mixture, for sampling what a photon does when it interacts. The
+// NIST data only has totals, so incoherent (Compton) and coherent (Rayleigh) scattering are integrated here
+// from Klein–Nishina and Thomson with a screened hydrogenic atom: F(q) = Z / (1 + a^2 q^2)^2 and
+// S(q) = Z (1 - (F / Z)^2), a = a0 / 2 Z^(-1/3), which is exact for hydrogen. Photoabsorption is what is left
+// of the tabulated total. Energies in MeV, coefficients in cm^2/g.
+class cross_sections {
+public:
+    static const int points_per_decade = 32; // the scattering terms have no edges
+    static constexpr double e_min = 0.001, e_max = 1.0; // range of the NIST tables
+
+    enum interaction { photoabsorption, compton, rayleigh };
+
+    cross_sections() {}
+
+    // composition: (atomic number, weight fraction) pairs
+    void build(const std::vector<std::pair<int, float>>& composition);
+
+    // What happens at an interaction of a photon of energy e, given the mixture's total mu/rho there and xi
+    // uniform in [0, 1). For scattering, atomic_number is the element it happens on.
+    interaction sample(float e, float mu_total, float xi, int& atomic_number) const;
+
+    float coherent(float e) const { return sum(log_coherent, e); }
+    float incoherent(float e) const { return sum(log_incoherent, e); }
+
+    // Screening length a [angstrom], wave number k [1/angstrom] of energy e [MeV], and (F / Z)^2 of the model
+    // as a function of a^2 q^2, q = 2 k sin(theta / 2)
+    static double screening_length(int atomic_number) { return 0.5 * 0.529177210903 / std::cbrt(atomic_number); }
+    static double wave_number(double e) { return e * 1E3 / 1.973269804; }
+    static double form_factor_squared(double a2q2) {
+        double g = 1 / (1 + a2q2);
+        return g * g * g * g;
+    }
+
+    // Standard atomic weight [g/mol]
+    static double atomic_weight(int atomic_number);
+
+private:
+    float log_e_min = 0;
+    float inv_step = 1;
+    int points = 0;
+    std::vector<int> elements;
+    std::vector<float> log_coherent;   // log(w_i mu_i/rho) of element i at grid point j, [i * points + j]
+    std::vector<float> log_incoherent;
+
+    float element_value(const std::vector<float>& table, int element, float x) const;
+    float sum(const std::vector<float>& table, float e) const;
+    float grid_x(float e) const;
+
+    // mu/rho of one element for both scattering processes, integrated over the scattering angle
+    static void element_scattering(int atomic_number, double e, double& coherent, double& incoherent);
+};
+
+void cross_sections::build(const std::vector<std::pair<int, float>>& composition) {
+    double log_min = std::log(e_min), log_max = std::log(e_max);
+    points = static_cast<int>(std::ceil((log_max - log_min) / std::log(10.0) * points_per_decade)) + 1;
+    double step = (log_max - log_min) / (points - 1);
+    log_e_min = static_cast<float>(log_min);
+    inv_step = static_cast<float>(1 / step);
+
+    elements.clear();
+    log_coherent.clear();
+    log_incoherent.clear();
+    for (const auto &element_weight: composition) {
+        elements.push_back(element_weight.first);
+        for (int j = 0; j < points; j++) {
+            double coh, inc;
+            element_scattering(element_weight.first, std::exp(log_min + j * step), coh, inc);
+            double weight = std::max(static_cast<double>(element_weight.second), 1e-30); // keeps the logs finite
+            log_coherent.push_back(static_cast<float>(std::log(weight * coh)));
+            log_incoherent.push_back(static_cast<float>(std::log(weight * inc)));
+        }
+    }
+}
+
+void cross_sections::element_scattering(int atomic_number, double e, double& coherent, double& incoherent) {
+    const double classical_radius2 = 7.9407877e-26; // r_e^2 [cm^2]
+    const double avogadro = 6.02214076e23;
+    const double a = screening_length(atomic_number);
+    const double k = wave_number(e);
+    const double kappa = e / 0.51099895; // in electron masses
+    const double c = 2 * a * a * k * k;  // a^2 q^2 = c (1 - cos theta)
+    const double z = atomic_number;
+
+    // Simpson's rule in y = log(1 + c s), s = 1 - cos theta, which spreads out the forward peak
+    const int intervals = 128;
+    double y_max = std::log(1 + 2 * c), h = y_max / intervals;
+    double coh = 0, inc = 0;
+    for (int i = 0; i <= intervals; i++) {
+        double y = i * h;
+        double ds = std::exp(y) / c;
+        double s = (std::exp(y) - 1) / c;
+        double cos_theta = 1 - s;
+        double f2 = form_factor_squared(c * s);
+        double p = 1 / (1 + kappa * s); // E' / E
+        double weight = (i == 0 || i == intervals ? 1 : (i % 2 ? 4 : 2)) * h / 3 * ds;
+        coh += weight * (1 + cos_theta * cos_theta) * z * z * f2;
+        inc += weight * p * p * (p + 1 / p - 1 + cos_theta * cos_theta) * z * (1 - f2);
+    }
+    double per_gram = pi * classical_radius2 * avogadro / atomic_weight(atomic_number);
+    coherent = coh * per_gram;
+    incoherent = inc * per_gram;
+}
+
+float cross_sections::grid_x(float e) const {
+    float x = (std::log(e) - log_e_min) * inv_step;
+    return std::max(0.0f, std::min(static_cast<float>(points - 1), x)); // held constant outside the tables
+}
+
+float cross_sections::element_value(const std::vector<float>& table, int element, float x) const {
+    int i = std::min(static_cast<int>(x), points - 2);
+    const float *y = &table[static_cast<size_t>(element) * points];
+    return std::exp(y[i] + (x - i) * (y[i + 1] - y[i]));
+}
+
+float cross_sections::sum(const std::vector<float>& table, float e) const {
+    float x = grid_x(e), total = 0;
+    for (int k = 0; k < elements.size(); k++) total += element_value(table, k, x);
+    return total;
+}
+
+cross_sections::interaction cross_sections::sample(float e, float mu_total, float xi, int& atomic_number) const {
+    float x = grid_x(e);
+    float coh = 0, inc = 0;
+    for (int k = 0; k < elements.size(); k++) {
+        coh += element_value(log_coherent, k, x);
+        inc += element_value(log_incoherent, k, x);
+    }
+
+    // photoabsorption is the rest of the total, none if the model's scattering alone exceeds it
+    float pick = xi * std::max(mu_total, coh + inc);
+    if (pick >= coh + inc) return photoabsorption;
+
+    const std::vector<float> &table = pick < inc ? log_incoherent : log_coherent;
+    if (pick >= inc) pick -= inc;
+    atomic_number = elements.back();
+    for (int k = 0; k < elements.size(); k++) {
+        pick -= element_value(table, k, x);
+        if (pick < 0) {
+            atomic_number = elements[k];
+            break;
+        }
+    }
+    return &table == &log_incoherent ? compton : rayleigh;
+}
+
+double cross_sections::atomic_weight(int atomic_number) {
+    static const double weights[] = {
+            1.008, 4.0026, 6.94, 9.0122, 10.81, 12.011, 14.007, 15.999, 18.998, 20.180,
+            22.990, 24.305, 26.982, 28.085, 30.974, 32.06, 35.45, 39.948, 39.098, 40.078,
+            44.956, 47.867, 50.942, 51.996, 54.938, 55.845, 58.933, 58.693, 63.546, 65.38,
+            69.723, 72.630, 74.922, 78.971, 79.904, 83.798, 85.468, 87.62, 88.906, 91.224,
+            92.906, 95.95, 98, 101.07, 102.91, 106.42, 107.87, 112.41, 114.82, 118.71,
+            121.76, 127.60, 126.90, 131.29, 132.91, 137.33, 138.91, 140.12, 140.91, 144.24,
+            145, 150.36, 151.96, 157.25, 158.93, 162.50, 164.93, 167.26, 168.93, 173.05,
+            174.97, 178.49, 180.95, 183.84, 186.21, 190.23, 192.22, 195.08, 196.97, 200.59,
+            204.38, 207.2, 208.98, 209, 210, 222, 223, 226, 227, 232.04,
+            231.04, 238.03};
+    if (atomic_number < 1 || atomic_number > 92) {
+        std::cerr << "No atomic weight for element " << atomic_number << std::endl;
+        exit(1);
+    }
+    return weights[atomic_number - 1];
+}
+
+#endif //CROSS_SECTIONS_H
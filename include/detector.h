@@ -0,0 +1,246 @@
+#ifndef DETECTOR_H
+#define DETECTOR_H
+
+#include "framebuffer.h"
+#include "json.h"
+#include "material.h"
+#include "philox.h"
+#include "spectrum.h"
+#include "thread_pool.h"
+
+#include <iostream>
+
+using nlohmann::json;
+
+// Detector model, configured by the "detector" section, so rendered images can be compared with measured ones
+// directly:
+//
+// {"response": {"material": "Cesium Iodide", "thickness": 0.06, "energy_integrating": true},
+//  "stages": [{"type": "poisson", "photons": 2000}, {"type": "blur", "sigma": 0.02},
+//             {"type": "gaussian", "sigma": 0.002}, {"type": "gain", "gain": 0.8, "offset": 0.1}, {"type": "log"}]}
+//
+// The response weights photons by the fraction absorbed in the scintillator (thickness [cm]), times their energy
+// for an energy integrating detector; it changes how the primary spectrum and scattered photons add up. The
+// stages then run in order over the rendered image, where 1 is the unattenuated beam:
+//   poisson   quantum noise, photons detected per pixel in the unattenuated beam
+//   blur      scintillator spread, a Gaussian of sigma [cm] at the detector plus an optional wider tail
+//             (tail_sigma [cm], tail_fraction of the signal)
+//   gaussian  additive electronic noise of standard deviation sigma
+//   gain      v -> gain v + offset
+//   log       v -> -ln(v), the line integral, values below floor (1e-6) are raised to it
+// Noise is drawn per pixel from Philox streams, so it does not depend on the number of threads. Stages run a row
+// of pixels per task on the renderer's threads.
+class detector {
+public:
+    detector() {}
+    // pixel_pitch [cm] converts the blur widths to pixels
+    detector(const json& config, float pixel_pitch);
+
+    // Relative weight of a detected photon of energy e [keV], 1 without a response
+    float response(float e) const;
+
+    // Source weights as the detector sees them, multiplied by the response and normalised
+    spectrum detected_spectrum(const spectrum& source) const;
+
+    // Runs the stages over image, view numbers the noise streams of each projection
+    void process(framebuffer& image, thread_pool& pool, uint64_t view = 0) const;
+
+public:
+    uint64_t seed = 1;
+
+private:
+    enum stage_type { poisson_noise, psf_blur, gaussian_noise, gain_offset, log_transform };
+    struct stage {
+        stage_type type;
+        float a, b, c; // poisson: photons; blur: sigma, tail_sigma, tail_fraction [pixels]; gaussian: sigma;
+                       // gain: gain, offset; log: floor
+    };
+
+    std::vector<stage> stages;
+    shared_ptr<material> scintillator;
+    float thickness = 0;
+    bool energy_integrating = true;
+
+    void add_noise(framebuffer& image, thread_pool& pool, const stage& s, uint64_t key) const;
+
+    // f(value, pixel index) for every pixel, a row per task
+    template<typename F>
+    static void for_pixels(framebuffer& image, thread_pool& pool, F f) {
+        pool.parallel_for(image.height, [&](size_t y, int) {
+            size_t row = y * image.width;
+            for (int x = 0; x < image.width; x++) f(image.pixels[row + x], row + x);
+        });
+    }
+    static void gaussian_blur(framebuffer& image, thread_pool& pool, float sigma);
+
+    static uint32_t poisson_sample(float mean, philox_stream& rng);
+    static float normal_sample(philox_stream& rng);
+};
+
+detector::detector(const json& config, float pixel_pitch) {
+    seed = config.value("seed", static_cast<uint64_t>(1));
+    if (config.empty()) return;
+
+    string name;
+    if (config.contains("response")) {
+        const json &response = config["response"];
+        name = response.value("material", string("Cesium Iodide"));
+        scintillator = make_shared<material>(name.c_str(), 40.0f);
+        thickness = response.value("thickness", 0.06f);
+        energy_integrating = response.value("energy_integrating", true);
+    }
+
+    std::cout << "<Detector>" << std::endl;
+    if (scintillator) {
+        std::cout << thickness << " cm " << name << (energy_integrating ? ", energy integrating" : ", counting")
+                  << std::endl;
+    }
+
+    for (const json &entry: config.value("stages", json::array())) {
+        string type = entry.value("type", string(""));
+        stage s{poisson_noise, 0, 0, 0};
+        if (type == "poisson") {
+            s = {poisson_noise, entry.value("photons", 1000.0f), 0, 0};
+        }
+        else if (type == "blur") {
+            s = {psf_blur, entry.value("sigma", 0.0f) / pixel_pitch, entry.value("tail_sigma", 0.0f) / pixel_pitch,
+                 entry.value("tail_fraction", 0.0f)};
+        }
+        else if (type == "gaussian") {
+            s = {gaussian_noise, entry.value("sigma", 0.0f), 0, 0};
+        }
+        else if (type == "gain") {
+            s = {gain_offset, entry.value("gain", 1.0f), entry.value("offset", 0.0f), 0};
+        }
+        else if (type == "log") {
+            s = {log_transform, entry.value("floor", 1e-6f), 0, 0};
+        }
+        else {
+            std::cerr << "Unknown detector stage \"" << type << "\", expected poisson, blur, gaussian, gain or log"
+                      << std::endl;
+            exit(1);
+        }
+        stages.push_back(s);
+        std::cout << "stage: " << type << std::endl;
+    }
+    std::cout << std::endl;
+}
+
+float detector::response(float e) const {
+    if (!scintillator) return 1;
+    float absorbed = 1 - std::exp(-scintillator->attenuation_at(e) * thickness);
+    return energy_integrating ? absorbed * e : absorbed;
+}
+
+spectrum detector::detected_spectrum(const spectrum& source) const {
+    spectrum detected = source;
+    float total = 0;
+    for (int i = 0; i < detected.size(); i++) {
+        detected.weights[i] *= response(detected.energies[i]);
+        total += detected.weights[i];
+    }
+    for (float &w: detected.weights) w /= total;
+    return detected;
+}
+
+void detector::process(framebuffer& image, thread_pool& pool, uint64_t view) const {
+    for (size_t i = 0; i < stages.size(); i++) {
+        const stage &s = stages[i];
+        switch (s.type) {
+            case poisson_noise:
+            case gaussian_noise:
+                add_noise(image, pool, s, seed + (view * stages.size() + i) * 0x9E3779B97F4A7C15ull);
+                break;
+            case psf_blur: {
+                if (s.c > 0 && s.b > 0) {
+                    framebuffer tail = image;
+                    gaussian_blur(tail, pool, s.b);
+                    gaussian_blur(image, pool, s.a);
+                    for_pixels(image, pool, [&](float& v, size_t p) { v = (1 - s.c) * v + s.c * tail.pixels[p]; });
+                }
+                else {
+                    gaussian_blur(image, pool, s.a);
+                }
+                break;
+            }
+            case gain_offset:
+                for_pixels(image, pool, [&](float& v, size_t) { v = s.a * v + s.b; });
+                break;
+            case log_transform:
+                for_pixels(image, pool, [&](float& v, size_t) { v = -std::log(std::max(v, s.a)); });
+                break;
+        }
+    }
+}
+
+void detector::add_noise(framebuffer& image, thread_pool& pool, const stage& s, uint64_t key) const {
+    for_pixels(image, pool, [&](float& v, size_t p) {
+        philox_stream rng(key, p);
+        if (s.type == poisson_noise) v = poisson_sample(std::max(v, 0.0f) * s.a, rng) / s.a;
+        else v += s.a * normal_sample(rng);
+    });
+}
+
+void detector::gaussian_blur(framebuffer& image, thread_pool& pool, float sigma) {
+    if (!(sigma > 0)) return;
+    int radius = static_cast<int>(std::ceil(3 * sigma));
+    std::vector<float> kernel(2 * radius + 1);
+    float total = 0;
+    for (int k = -radius; k <= radius; k++) total += kernel[k + radius] = std::exp(-0.5f * k * k / (sigma * sigma));
+    for (float &w: kernel) w /= total;
+
+    // rows then columns, clamped to the edge pixels
+    const int width = image.width, height = image.height;
+    framebuffer rows(width, height);
+    pool.parallel_for(height, [&](size_t y, int) {
+        for (int x = 0; x < width; x++) {
+            float sum = 0;
+            for (int k = -radius; k <= radius; k++) {
+                sum += kernel[k + radius] * image.at(std::max(0, std::min(width - 1, x + k)), static_cast<int>(y));
+            }
+            rows.at(x, static_cast<int>(y)) = sum;
+        }
+    });
+    pool.parallel_for(height, [&](size_t y, int) {
+        float *out = &image.at(0, static_cast<int>(y));
+        for (int x = 0; x < width; x++) out[x] = 0;
+        for (int k = -radius; k <= radius; k++) {
+            const float *in = &rows.at(0, std::max(0, std::min(height - 1, static_cast<int>(y) + k)));
+            float w = kernel[k + radius];
+            for (int x = 0; x < width; x++) out[x] += w * in[x];
+        }
+    });
+}
+
+uint32_t detector::poisson_sample(float mean, philox_stream& rng) {
+    if (mean < 30) {
+        // multiply uniforms until the product drops below exp(-mean)
+        float limit = std::exp(-mean), product = 1;
+        uint32_t k = 0;
+        while ((product *= 1 - rng.uniform()) > limit) k++;
+        return k;
+    }
+
+    // transformed rejection with squeeze (Hörmann, PTRS)
+    double slam = std::sqrt(mean), log_mean = std::log(mean);
+    double b = 0.931 + 2.53 * slam, a = -0.059 + 0.02483 * b;
+    double inv_alpha = 1.1239 + 1.1328 / (b - 3.4), vr = 0.9277 - 3.6224 / (b - 2);
+    while (true) {
+        double u = rng.uniform() - 0.5, v = rng.uniform();
+        double us = 0.5 - std::fabs(u);
+        if (!(us > 0)) continue;
+        double k = std::floor((2 * a / us + b) * u + mean + 0.43);
+        if (us >= 0.07 && v <= vr) return static_cast<uint32_t>(k);
+        if (k < 0 || (us < 0.013 && v > us)) continue;
+        if (std::log(v) + std::log(inv_alpha) - std::log(a / (us * us) + b) <=
+            -mean + k * log_mean - std::lgamma(k + 1)) return static_cast<uint32_t>(k);
+    }
+}
+
+float detector::normal_sample(philox_stream& rng) {
+    // Box–Muller
+    float u1 = 1 - rng.uniform(), u2 = rng.uniform();
+    return std::sqrt(-2 * std::log(u1)) * std::cos(2 * static_cast<float>(pi) * u2);
+}
+
+#endif //DETECTOR_H
@@ -0,0 +1,90 @@
+#ifndef FOCAL_SPOT_H
+#define FOCAL_SPOT_H
+
+#include "json.h"
+#include "utility.h"
+
+#include <cstdint>
+#include <iostream>
+
+using nlohmann::json;
+
+// Finite x-ray focal spot, configured by "focal_spot" in the source section:
+//
+// {"size": 0.05, "profile": "uniform", "samples": 16, "adaptive": true, "edge_threshold": 0.005}
+//
+// The source is spread over a disc of diameter size [cm] facing the detector ("uniform"), or a Gaussian of that
+// full width at half maximum ("gaussian"). Pixels are averaged over samples source points, a Hammersley set
+// shifted per pixel (Cranley–Patterson rotation), so the penumbra is smooth rather than a few shifted copies of
+// each edge. In adaptive mode a point source image is rendered first, and only the pixels within a penumbra
+// width of a contrast step larger than edge_threshold are supersampled.
+class focal_spot {
+public:
+    enum spot_profile { uniform, gaussian };
+
+    focal_spot() {}
+    explicit focal_spot(const json& config);
+
+    bool enabled() const { return size > 0 && samples > 1; }
+
+    // Source point of sample (s, t) in [0, 1)^2, offsets [cm] along the detector's horizontal and vertical
+    void offset(float s, float t, float& x, float& y) const;
+
+    // Width [cm] the spot covers, the whole disc or four standard deviations of the Gaussian
+    float extent() const { return profile == uniform ? size : 4 * size / 2.3548f; }
+
+public:
+    float size = 0;
+    spot_profile profile = uniform;
+    int samples = 16;
+    bool adaptive = true;
+    float edge_threshold = 0.005f;
+};
+
+focal_spot::focal_spot(const json& config) :
+        size(config.value("size", 0.0f)),
+        samples(std::max(1, config.value("samples", 16))),
+        adaptive(config.value("adaptive", true)),
+        edge_threshold(config.value("edge_threshold", 0.005f)) {
+    string shape = config.value("profile", string("uniform"));
+    if (shape == "gaussian") {
+        profile = gaussian;
+    }
+    else if (shape != "uniform") {
+        std::cerr << "Unknown focal spot profile \"" << shape << "\", expected uniform or gaussian" << std::endl;
+        exit(1);
+    }
+    if (enabled()) {
+        std::cout << "<Focal Spot>\n" << size << " cm " << shape << ", " << samples << " samples per pixel"
+                  << (adaptive ? " near edges" : "") << "\n" << std::endl;
+    }
+}
+
+void focal_spot::offset(float s, float t, float& x, float& y) const {
+    if (profile == gaussian) {
+        // Box–Muller keeps the stratification of (s, t) in radius and angle
+        float r = size / 2.3548f * std::sqrt(-2 * std::log(1 - s));
+        x = r * std::cos(2 * static_cast<float>(pi) * t);
+        y = r * std::sin(2 * static_cast<float>(pi) * t);
+        return;
+    }
+
+    // Shirley–Chiu concentric map from the square to the disc, area preserving and low distortion
+    float a = 2 * s - 1, b = 2 * t - 1, r, phi;
+    if (a == 0 && b == 0) {
+        x = y = 0;
+        return;
+    }
+    if (a * a > b * b) {
+        r = a;
+        phi = static_cast<float>(pi) / 4 * (b / a);
+    }
+    else {
+        r = b;
+        phi = static_cast<float>(pi) / 2 - static_cast<float>(pi) / 4 * (a / b);
+    }
+    x = size / 2 * r * std::cos(phi);
+    y = size / 2 * r * std::sin(phi);
+}
+
+#endif //FOCAL_SPOT_H
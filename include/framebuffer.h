@@ -0,0 +1,21 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <vector>
+
+// In-memory float image, rows stored top to bottom like the output files.
+class framebuffer {
+public:
+    framebuffer() : width(0), height(0) {}
+    framebuffer(int w, int h) : width(w), height(h), pixels(static_cast<size_t>(w) * h, 0.0f) {}
+
+    float& at(int x, int y) { return pixels[static_cast<size_t>(y) * width + x]; }
+    float at(int x, int y) const { return pixels[static_cast<size_t>(y) * width + x]; }
+
+public:
+    int width;
+    int height;
+    std::vector<float> pixels;
+};
+
+#endif //FRAMEBUFFER_H
@@ -4,16 +4,64 @@
 #include "ray.h"
 #include "material.h"
 #include "utility.h"
+#include "aabb.h"
+#include "small_vector.h"
+#include "ray_packet.h"
 
+// Crossings are kept inline, so tracing a ray allocates nothing unless it crosses more than
+// max_inline_hits surfaces.
+const int max_inline_hits = 32;
+
+// Distance travelled through one material, kept so transmission can be evaluated per energy bin
+struct path_segment {
+    const material* mat;
+    float length;
+};
+
+// Stretch [t_in, t_out] of the ray inside one object. Where intervals overlap, the one of higher priority
+// (then the one recorded last) decides the material. The geometric length is multiplied by scale, which is 1
+// except for density volumes.
+struct path_interval {
+    const material* mat;
+    float t_in, t_out;
+    int priority;
+    float scale;
+};
+
+// Objects append their crossings and intervals; resolve_transport() then turns the intervals into segments
+// and trans_prob.
 struct hit_record {
-    std::vector<vec3> p;
-    std::vector<float> t;
-    float trans_prob;
+    small_vector<vec3, max_inline_hits> p;
+    small_vector<float, max_inline_hits> t;
+    small_vector<path_interval, max_inline_hits> intervals; // appended by every object the ray crosses
+    small_vector<path_segment, max_inline_hits> segments;   // one per material, after resolve_transport()
+    float trans_prob = 1;
+
+    // Empties the record for the next ray, keeping any heap capacity
+    void clear() {
+        p.clear();
+        t.clear();
+        intervals.clear();
+        segments.clear();
+        trans_prob = 1;
+    }
 };
 
 class hittable {
 public:
     virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const = 0;
+    virtual bool bounding_box(aabb& output_box) const = 0;
+
+    // Traces every ray of the packet, hits[i] and recs[i] as hit() would give for packet.rays[i]. Objects that
+    // can share work between coherent rays override it, the others trace the rays one at a time.
+    virtual void hit_packet(const ray_packet& packet, float t_min, float t_max, hit_record* recs, bool* hits) const {
+        for (int i = 0; i < packet.size; i++) {
+            hits[i] = hit(packet.rays[i], t_min, t_max, recs[i]);
+        }
+    }
+
+public:
+    int priority = 0; // wins over lower priorities where objects overlap, e.g. a liquid inside its container
 };
 
 #endif //HITTABLE_H
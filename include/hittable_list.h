@@ -2,6 +2,7 @@
 #define HITTABLE_LIST_H
 
 #include "hittable.h"
+#include "bvh.h"
 
 #include <memory>
 #include <vector>
@@ -14,28 +15,108 @@ public:
     hittable_list() {}
     hittable_list(shared_ptr<hittable> object) { add(object); }
 
-    void clear() { objects.clear(); }
+    void clear() { objects.clear(); tree = bvh(); unbounded.clear(); }
     void add(shared_ptr<hittable> object) { objects.push_back(object); }
 
+    // Builds the top level BVH over the object boxes, call again after adding objects. Until then every ray
+    // tests every object.
+    void build_bvh();
+
     virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
+    virtual bool bounding_box(aabb& output_box) const override;
+    virtual void hit_packet(const ray_packet& packet, float t_min, float t_max, hit_record* recs,
+                            bool* hits) const override;
 
 public:
     std::vector<shared_ptr<hittable>> objects;
+
+private:
+    bvh tree;                   // over the bounded objects, indices into objects
+    std::vector<int> unbounded; // objects without a bounding box, always tested
+    std::vector<int> bounded;   // tree primitive -> object index
+
+    // Calls visit(object) for every object the ray r (or, when r is null, any ray of packet) may cross, in the
+    // order they were added
+    template<typename F>
+    void for_candidates(const ray* r, const ray_packet* packet, float t_min, float t_max, F&& visit) const;
 };
 
+void hittable_list::build_bvh() {
+    std::vector<aabb> boxes;
+    bounded.clear();
+    unbounded.clear();
+    aabb box;
+    for (int i = 0; i < objects.size(); i++) {
+        if (objects[i]->bounding_box(box)) {
+            boxes.push_back(box);
+            bounded.push_back(i);
+        }
+        else {
+            unbounded.push_back(i);
+        }
+    }
+    tree.build(boxes);
+}
+
+template<typename F>
+void hittable_list::for_candidates(const ray* r, const ray_packet* packet, float t_min, float t_max,
+                                   F&& visit) const {
+    if (tree.empty() && unbounded.empty()) { // no top level BVH, test everything
+        for (const auto &object: objects) visit(*object);
+        return;
+    }
+
+    small_vector<int, max_inline_hits> candidates;
+    for (int i: unbounded) candidates.push_back(i);
+    if (r) {
+        tree.traverse(*r, t_min, t_max, [&](int prim) { candidates.push_back(bounded[prim]); });
+    }
+    else {
+        tree.traverse_packet(*packet, t_min, t_max, [&](int first, int count, uint64_t) {
+            for (int i = first; i < first + count; i++) candidates.push_back(bounded[tree.prim_indices[i]]);
+        });
+    }
+    std::sort(candidates.begin(), candidates.end()); // combine in the order the objects were added
+    for (int k = 0; k < candidates.size(); k++) {
+        if (k > 0 && candidates[k] == candidates[k - 1]) continue; // leaf reached by several rays of a packet
+        visit(*objects[candidates[k]]);
+    }
+}
+
 bool hittable_list::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
-    hit_record temp_rec; // temp_rec is used to store the hit_record of all objects
     bool hit_anything = false;  // hit_anything is used to check if any object is hit
-    float total_prob = 1.0;  // total_prob is used to store the total probability of the transmission
-
-    for (const auto &object: objects) { // loop through all objects
-        if (object->hit(r, t_min, t_max, temp_rec)) {
-            hit_anything = true;
-            total_prob *= temp_rec.trans_prob; // update the total_prob
-            temp_rec.trans_prob = total_prob;
-            rec = temp_rec;
+
+    // every object appends its intervals to rec, the transport stage combines them afterwards
+    for_candidates(&r, nullptr, t_min, t_max, [&](const hittable& object) { // loop through all objects the ray may cross
+        if (object.hit(r, t_min, t_max, rec)) hit_anything = true;
+    });
+    return hit_anything;
+}
+
+void hittable_list::hit_packet(const ray_packet& packet, float t_min, float t_max, hit_record* recs,
+                               bool* hits) const {
+    bool object_hits[ray_packet::max_size];
+    for (int i = 0; i < packet.size; i++) {
+        hits[i] = false;
+    }
+
+    for_candidates(nullptr, &packet, t_min, t_max, [&](const hittable& object) {
+        object.hit_packet(packet, t_min, t_max, recs, object_hits);
+        for (int i = 0; i < packet.size; i++) {
+            hits[i] = hits[i] || object_hits[i];
         }
+    });
+}
+
+bool hittable_list::bounding_box(aabb &output_box) const {
+    if (objects.empty()) return false;
+
+    output_box = aabb();
+    aabb temp_box;
+    for (const auto &object: objects) {
+        if (!object->bounding_box(temp_box)) return false; // unbounded object, so the list is too
+        output_box.expand(temp_box);
     }
-    return hit_anything;
+    return true;
 }
 #endif //HITTABLE_LIST_H
@@ -0,0 +1,283 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include "color.h"
+#include "framebuffer.h"
+#include "utility.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+// Writes a framebuffer straight to disk, no external converter needed. Greyscale formats store the inverted
+// grey level like the detector images (pgm, png: 8 bit, pgm16, png16: 16 bit). The quantitative formats store
+// the transmitted intensity itself as float32 (npy, tiff).
+class image_writer {
+public:
+    static bool is_format(const string& format);
+    static string extension(const string& format);
+
+    // Writes image to basename + the format's extension, returns false when the file could not be written
+    static bool write(const framebuffer& image, const string& basename, const string& format);
+
+private:
+    static void write_pgm(std::ofstream& file, const framebuffer& image, int bits);
+    static void write_png(std::ofstream& file, const framebuffer& image, int bits);
+    static void write_npy(std::ofstream& file, const framebuffer& image);
+    static void write_npy_header(std::ofstream& file, const string& shape);
+    static void write_tiff(std::ofstream& file, const framebuffer& image);
+
+    static void put_u16_be(std::vector<unsigned char>& out, uint16_t value);
+    static void put_u32_be(std::vector<unsigned char>& out, uint32_t value);
+    static void write_png_chunk(std::ofstream& file, const char* type, const std::vector<unsigned char>& data);
+    static uint32_t crc32(const unsigned char* data, size_t size, uint32_t crc = 0);
+
+    friend class npy_stack_writer;
+};
+
+bool image_writer::is_format(const string& format) {
+    return format == "pgm" || format == "pgm16" || format == "png" || format == "png16" ||
+           format == "npy" || format == "tiff";
+}
+
+string image_writer::extension(const string& format) {
+    if (format == "pgm16") return ".pgm";
+    if (format == "png16") return ".png";
+    if (format == "tiff") return ".tif";
+    return "." + format;
+}
+
+bool image_writer::write(const framebuffer& image, const string& basename, const string& format) {
+    if (!is_format(format)) {
+        std::cerr << "Unknown image format " << format << std::endl;
+        return false;
+    }
+
+    string filename = basename + extension(format);
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) {
+        std::cerr << "Error opening " << filename << " for writing" << std::endl;
+        return false;
+    }
+
+    if (format == "pgm") write_pgm(file, image, 8);
+    else if (format == "pgm16") write_pgm(file, image, 16);
+    else if (format == "png") write_png(file, image, 8);
+    else if (format == "png16") write_png(file, image, 16);
+    else if (format == "npy") write_npy(file, image);
+    else if (format == "tiff") write_tiff(file, image);
+
+    file.close();
+    if (!file) {
+        std::cerr << "Error writing " << filename << std::endl;
+        return false;
+    }
+    std::cout << "Wrote " << filename << std::endl;
+    return true;
+}
+
+void image_writer::write_pgm(std::ofstream& file, const framebuffer& image, int bits) {
+    int max_value = bits == 16 ? 65535 : 255;
+    file << "P5\n" << image.width << ' ' << image.height << '\n' << max_value << '\n';
+
+    std::vector<unsigned char> row;
+    for (int y = 0; y < image.height; y++) {
+        row.clear();
+        for (int x = 0; x < image.width; x++) {
+            int level = grey_level(image.at(x, y), max_value);
+            if (bits == 16) put_u16_be(row, level); // 16 bit samples are big endian
+            else row.push_back(static_cast<unsigned char>(level));
+        }
+        file.write(reinterpret_cast<const char*>(row.data()), row.size());
+    }
+}
+
+void image_writer::write_png(std::ofstream& file, const framebuffer& image, int bits) {
+    // raw scanlines, each led by filter type 0 (none)
+    int max_value = bits == 16 ? 65535 : 255;
+    std::vector<unsigned char> raw;
+    raw.reserve(static_cast<size_t>(image.height) * (1 + image.width * bits / 8));
+    for (int y = 0; y < image.height; y++) {
+        raw.push_back(0);
+        for (int x = 0; x < image.width; x++) {
+            int level = grey_level(image.at(x, y), max_value);
+            if (bits == 16) put_u16_be(raw, level);
+            else raw.push_back(static_cast<unsigned char>(level));
+        }
+    }
+
+    // zlib stream made of stored (uncompressed) deflate blocks
+    std::vector<unsigned char> zlib = {0x78, 0x01};
+    zlib.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+    size_t offset = 0;
+    do {
+        size_t block = std::min<size_t>(65535, raw.size() - offset);
+        bool last = offset + block == raw.size();
+        zlib.push_back(last ? 1 : 0);
+        zlib.push_back(block & 0xFF);
+        zlib.push_back(block >> 8);
+        zlib.push_back(~block & 0xFF);
+        zlib.push_back((~block >> 8) & 0xFF);
+        zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + block);
+        offset += block;
+    } while (offset < raw.size());
+
+    uint32_t a = 1, b = 0; // adler32 of the uncompressed data
+    for (unsigned char c: raw) {
+        a = (a + c) % 65521;
+        b = (b + a) % 65521;
+    }
+    put_u32_be(zlib, (b << 16) | a);
+
+    std::vector<unsigned char> header;
+    put_u32_be(header, image.width);
+    put_u32_be(header, image.height);
+    header.push_back(bits);
+    header.push_back(0); // greyscale
+    header.push_back(0); // deflate
+    header.push_back(0); // adaptive filtering
+    header.push_back(0); // no interlace
+
+    const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    file.write(reinterpret_cast<const char*>(signature), 8);
+    write_png_chunk(file, "IHDR", header);
+    write_png_chunk(file, "IDAT", zlib);
+    write_png_chunk(file, "IEND", {});
+}
+
+void image_writer::write_npy(std::ofstream& file, const framebuffer& image) {
+    write_npy_header(file, std::to_string(image.height) + ", " + std::to_string(image.width));
+    file.write(reinterpret_cast<const char*>(image.pixels.data()), image.pixels.size() * sizeof(float));
+}
+
+void image_writer::write_npy_header(std::ofstream& file, const string& shape) {
+    string header = "{'descr': '<f4', 'fortran_order': False, 'shape': (" + shape + "), }";
+    size_t total = 10 + header.size() + 1;
+    header.append((64 - total % 64) % 64, ' '); // pad so the data starts 64 byte aligned
+    header.push_back('\n');
+
+    uint16_t header_size = static_cast<uint16_t>(header.size());
+    file.write("\x93NUMPY\x01\x00", 8);
+    file.write(reinterpret_cast<const char*>(&header_size), 2);
+    file << header;
+}
+
+void image_writer::write_tiff(std::ofstream& file, const framebuffer& image) {
+    // little endian baseline TIFF, one uncompressed strip of 32 bit float samples
+    struct ifd_entry { uint16_t tag, type; uint32_t count, value; };
+    const uint32_t image_bytes = static_cast<uint32_t>(image.pixels.size() * sizeof(float));
+    const uint32_t data_offset = 8;
+    const ifd_entry entries[] = {
+            {256, 4, 1, static_cast<uint32_t>(image.width)},  // ImageWidth
+            {257, 4, 1, static_cast<uint32_t>(image.height)}, // ImageLength
+            {258, 3, 1, 32},                                  // BitsPerSample
+            {259, 3, 1, 1},                                   // Compression: none
+            {262, 3, 1, 1},                                   // PhotometricInterpretation: BlackIsZero
+            {273, 4, 1, data_offset},                         // StripOffsets
+            {277, 3, 1, 1},                                   // SamplesPerPixel
+            {278, 4, 1, static_cast<uint32_t>(image.height)}, // RowsPerStrip
+            {279, 4, 1, image_bytes},                         // StripByteCounts
+            {339, 3, 1, 3},                                   // SampleFormat: IEEE float
+    };
+    const uint16_t num_entries = sizeof(entries) / sizeof(entries[0]);
+    const uint32_t ifd_offset = data_offset + image_bytes;
+
+    file.write("II*\0", 4);
+    file.write(reinterpret_cast<const char*>(&ifd_offset), 4);
+    file.write(reinterpret_cast<const char*>(image.pixels.data()), image_bytes);
+    file.write(reinterpret_cast<const char*>(&num_entries), 2);
+    for (const ifd_entry &e: entries) {
+        file.write(reinterpret_cast<const char*>(&e.tag), 2);
+        file.write(reinterpret_cast<const char*>(&e.type), 2);
+        file.write(reinterpret_cast<const char*>(&e.count), 4);
+        uint32_t value = e.value; // SHORT values sit in the low bytes of the field on little endian
+        file.write(reinterpret_cast<const char*>(&value), 4);
+    }
+    const uint32_t next_ifd = 0;
+    file.write(reinterpret_cast<const char*>(&next_ifd), 4);
+}
+
+void image_writer::put_u16_be(std::vector<unsigned char>& out, uint16_t value) {
+    out.push_back(value >> 8);
+    out.push_back(value & 0xFF);
+}
+
+void image_writer::put_u32_be(std::vector<unsigned char>& out, uint32_t value) {
+    out.push_back(value >> 24);
+    out.push_back((value >> 16) & 0xFF);
+    out.push_back((value >> 8) & 0xFF);
+    out.push_back(value & 0xFF);
+}
+
+void image_writer::write_png_chunk(std::ofstream& file, const char* type, const std::vector<unsigned char>& data) {
+    std::vector<unsigned char> length;
+    put_u32_be(length, static_cast<uint32_t>(data.size()));
+    file.write(reinterpret_cast<const char*>(length.data()), 4);
+    file.write(type, 4);
+    file.write(reinterpret_cast<const char*>(data.data()), data.size());
+
+    uint32_t crc = crc32(reinterpret_cast<const unsigned char*>(type), 4);
+    crc = crc32(data.data(), data.size(), crc);
+    std::vector<unsigned char> crc_bytes;
+    put_u32_be(crc_bytes, crc);
+    file.write(reinterpret_cast<const char*>(crc_bytes.data()), 4);
+}
+
+uint32_t image_writer::crc32(const unsigned char* data, size_t size, uint32_t crc) {
+    static uint32_t table[256];
+    static bool table_ready = [] {
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++) {
+                c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            table[n] = c;
+        }
+        return true;
+    }();
+    (void) table_ready;
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+// Float32 .npy volume of shape (views, height, width), filled one view at a time so a whole sweep never has
+// to be held in memory.
+class npy_stack_writer {
+public:
+    bool open(const string& basename, size_t views, int width, int height) {
+        filename = basename + ".npy";
+        file.open(filename, std::ios::binary);
+        if (!file) {
+            std::cerr << "Error opening " << filename << " for writing" << std::endl;
+            return false;
+        }
+        image_writer::write_npy_header(file, std::to_string(views) + ", " + std::to_string(height) + ", " +
+                                             std::to_string(width));
+        return true;
+    }
+
+    void append(const framebuffer& image) {
+        file.write(reinterpret_cast<const char*>(image.pixels.data()), image.pixels.size() * sizeof(float));
+    }
+
+    bool close() {
+        file.close();
+        if (!file) {
+            std::cerr << "Error writing " << filename << std::endl;
+            return false;
+        }
+        std::cout << "Wrote " << filename << std::endl;
+        return true;
+    }
+
+private:
+    string filename;
+    std::ofstream file;
+};
+
+#endif //IMAGE_WRITER_H
@@ -0,0 +1,62 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "hittable.h"
+#include "mesh.h"
+#include "transform.h"
+
+// One placement of a shared mesh. The mesh stays in its own (object) space and is never copied, rays are
+// taken into object space instead, so any number of instances cost one set of triangles and one BVH. The
+// transform may rotate and scale, since t is unchanged by the affine map, crossings and intervals are
+// recorded along the world ray.
+class instance : public hittable {
+public:
+    // m overrides the mesh's material, null keeps it
+    instance(shared_ptr<mesh> object, const affine_transform& to_world, shared_ptr<material> m = nullptr);
+
+    virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
+    virtual bool bounding_box(aabb& output_box) const override;
+    virtual void hit_packet(const ray_packet& packet, float t_min, float t_max, hit_record* recs,
+                            bool* hits) const override;
+
+public:
+    shared_ptr<mesh> object;
+    affine_transform to_world;
+    affine_transform to_object;
+    shared_ptr<material> mat_ptr;
+
+private:
+    aabb box; // world space
+
+    ray object_ray(const ray& r) const { return ray(to_object.apply_point(r.orig), to_object.apply_vector(r.dir)); }
+};
+
+instance::instance(shared_ptr<mesh> object, const affine_transform& to_world, shared_ptr<material> m) :
+        object(object),
+        to_world(to_world),
+        to_object(to_world.inverse()),
+        mat_ptr(m ? m : object->mat_ptr) {
+    aabb object_box;
+    if (object->bounding_box(object_box)) box = to_world.apply(object_box);
+}
+
+bool instance::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+    return object->trace(object_ray(r), r, t_min, t_max, rec, mat_ptr.get(), priority);
+}
+
+bool instance::bounding_box(aabb& output_box) const {
+    if (!object->has_tree()) return false;
+    output_box = box;
+    return true;
+}
+
+void instance::hit_packet(const ray_packet& packet, float t_min, float t_max, hit_record* recs, bool* hits) const {
+    ray_packet object_packet;
+    for (int i = 0; i < packet.size; i++) {
+        object_packet.add(object_ray(packet.rays[i]));
+    }
+    object_packet.finalize();
+    object->trace_packet(object_packet, packet, t_min, t_max, recs, hits, mat_ptr.get(), priority);
+}
+
+#endif //INSTANCE_H
@@ -0,0 +1,71 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <algorithm>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read-only memory mapping of a whole file, unmapped when it goes out of scope.
+class mapped_file {
+public:
+    mapped_file() {}
+    explicit mapped_file(const std::string& filename) { open(filename); }
+    ~mapped_file() { close(); }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    bool open(const std::string& filename);
+    void close();
+
+    bool is_open() const { return bytes != nullptr; }
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+    // Drops the whole pages within [offset, offset + count) from memory, they are read from the file again if used.
+    // Keeps the resident size of a long sequential read bounded.
+    void release(size_t offset, size_t count) const;
+
+private:
+    const char* bytes = nullptr;
+    size_t length = 0;
+};
+
+bool mapped_file::open(const std::string& filename) {
+    close();
+
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) { // empty files cannot be mapped
+        ::close(fd);
+        return false;
+    }
+
+    void* address = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd); // the mapping keeps the file open
+    if (address == MAP_FAILED) return false;
+
+    bytes = static_cast<const char*>(address);
+    length = info.st_size;
+    return true;
+}
+
+void mapped_file::release(size_t offset, size_t count) const {
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t first = (offset + page - 1) / page * page, last = std::min(offset + count, length) / page * page;
+    if (bytes && first < last) madvise(const_cast<char*>(bytes) + first, last - first, MADV_DONTNEED);
+}
+
+void mapped_file::close() {
+    if (bytes) munmap(const_cast<char*>(bytes), length);
+    bytes = nullptr;
+    length = 0;
+}
+
+#endif //MAPPED_FILE_H
@@ -2,6 +2,13 @@
 #define MATERIAL_H
 #include "utility.h"
 #include "json.h"
+#include "attenuation_db.h"
+#include "attenuation_table.h"
+#include "cross_sections.h"
+#include "spectrum.h"
+
+#include <fstream>
+#include <sstream>
 
 
 using nlohmann::json;
@@ -14,6 +21,7 @@ public:
             composition(),
             mu_m(0.0f) {
         extractComposition();
+        buildAttenuationTable();
         findMassAttenuationCoefficient();
     }
 
@@ -22,6 +30,36 @@ public:
         return exp(-mu_m * rho * d);
     }
 
+    float linear_attenuation() const { return mu_m * rho; } // mu [1/cm] at the effective energy
+
+    const string& material_name() const { return name; }
+    float density() const { return rho; } // [g/cm^3]
+
+    // Precomputes the linear attenuation coefficient for every bin of the source spectrum
+    void use_spectrum(const spectrum& source) {
+        std::vector<float> energies_MeV(source.size());
+        for (int i = 0; i < source.size(); i++) {
+            energies_MeV[i] = source.energies[i] / 1E3;
+        }
+        mu_spectrum.resize(source.size());
+        table.mu_over_rho(energies_MeV.data(), mu_spectrum.data(), mu_spectrum.size());
+        for (float &mu: mu_spectrum) {
+            mu *= rho;
+        }
+    }
+
+    // mu [1/cm] per spectrum bin, empty until use_spectrum() is called
+    const std::vector<float>& spectral_mu() const { return mu_spectrum; }
+
+    // mu [1/cm] at photon energy e [keV], for photons that are tracked individually
+    float attenuation_at(float e) const { return table.mu_over_rho(e / 1E3) * rho; }
+
+    // What a photon of energy e [keV] does when it interacts here, xi uniform in [0, 1). For scattering,
+    // atomic_number is the element that scatters it.
+    cross_sections::interaction sample_interaction(float e, float xi, int& atomic_number) const {
+        return scattering.sample(e / 1E3, table.mu_over_rho(e / 1E3), xi, atomic_number);
+    }
+
 
 private:
     struct ElementalContribution {
@@ -34,6 +72,9 @@ private:
     std::vector<ElementalContribution> composition;
     float mu_m;
     float rho;
+    std::vector<float> mu_spectrum;
+    attenuation_table table;
+    cross_sections scattering;
 
 
     void extractComposition() {
@@ -71,28 +112,29 @@ private:
         }
     }
 
-    void findMassAttenuationCoefficient() {
-        std::ifstream file("/home/john/XRayTracing/materials/nist_mu.dat");
-        json j;
-        file >> j;
-
-        mu_m = 0;
-        // loop over all elements in composition
-        for (auto &e: composition) {
-            int atomicNumber = e.atomicNumber;
-            float fractionWeight = e.fractionWeight;
-
-            // find the mass attenuation coefficient for the current element
-            int elementIndex = atomicNumber - 1;
-            std::vector<float> photonEnergy = j["photon energy"][elementIndex];
-            std::vector<float> mu_over_rho = j["mu_over_rho"][elementIndex];
+    // Resamples mu/rho of the mixture onto a log-log table and integrates its scattering cross sections
+    void buildAttenuationTable() {
+        const attenuation_database &db = attenuation_database::instance();
+
+        std::vector<std::pair<int, float>> weights;
+        for (auto &element: composition) {
+            if (!db.has_element(element.atomicNumber)) {
+                std::cerr << "No attenuation data for element " << element.atomicNumber << " in " << name << std::endl;
+                exit(1);
+            }
+            weights.push_back({element.atomicNumber, element.fractionWeight});
+        }
+        table.build(weights);
+        scattering.build(weights);
+    }
 
-            // interpolate the mass attenuation coefficient at the effective energy
-            float mu_m_i = interpolate(photonEnergy, mu_over_rho, energy);
+    // mu/rho of the mixture at photon energy e [MeV]
+    float massAttenuationCoefficient(float e) const {
+        return table.mu_over_rho(e);
+    }
 
-            // Add the contribution of the current element to the total mass attenuation coefficient
-            mu_m += mu_m_i * fractionWeight;
-        }
+    void findMassAttenuationCoefficient() {
+        mu_m = massAttenuationCoefficient(energy);
         std::cout << "<Mass Attenuation Coefficient>" << std::endl;
         std::cout << name << ": Effective Energy = " << energy*1E3<< " keV, mu/rho = " << mu_m << " cm^2/g" << ", rho = " << rho << " g/cm^2\n" << std::endl;
     }
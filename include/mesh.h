@@ -3,8 +3,13 @@
 
 #include "hittable_list.h"
 #include "vec3.h"
-#include "triangle.h"
+#include "triangle_store.h"
+#include "triangle_simd.h"
 #include "stl_reader.h"
+#include "stl_stream.h"
+#include "bvh.h"
+#include "wide_bvh.h"
+#include "mesh_cache.h"
 #include <algorithm>
 
 using std::shared_ptr;
@@ -14,30 +19,123 @@ using namespace std;
 class mesh : public hittable {
     public:
     mesh() {}
-    mesh(const char* filename, vec3 position, shared_ptr<material> m) : mat_ptr(m), pos(position) { read_obj(filename); }
+    mesh(const char* filename, vec3 position, shared_ptr<material> m) : mat_ptr(m), pos(position) { load(filename); }
 
-    virtual void read_obj(const char* filename);
+    // Loading reads the STL in chunks of chunk_triangles straight into the triangle store (stream_obj) unless
+    // streaming is off, in which case it is read whole and welded first (read_obj)
+    static void set_streaming(bool enabled, size_t chunk_triangles = 1 << 16) {
+        settings().streaming = enabled;
+        settings().chunk_triangles = std::max<size_t>(1, chunk_triangles);
+    }
+
+    // Loaded meshes are traced through a wide_bvh collapsed from tree, which is then dropped, unless this is off
+    static void set_wide_bvh(bool enabled) { settings().wide_trees = enabled; }
+
+    // Reads the STL (or its up to date cache), builds the BVH, moves the mesh to pos and collapses the BVH
+    void load(const char* filename);
+    virtual void read_obj(const char* filename); // adds the STL triangles in object space
+    // read_obj without the welded copy of the file: peak memory is the triangle store plus one chunk. Triangles
+    // with two equal corners are dropped as the welding would, the cache then holds no vertex and index arrays.
+    void stream_obj(const char* filename);
+    void build_bvh(); // must be called again after triangles are added, traces through tree from then on
+    bool has_tree() const { return !tree.empty() || !wide_tree.empty(); }
 
     virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
+    virtual bool bounding_box(aabb& output_box) const override;
+    virtual void hit_packet(const ray_packet& packet, float t_min, float t_max, hit_record* recs,
+                            bool* hits) const override;
+
+    // hit() for a ray already taken into the mesh's space: object_ray is traced, while crossings, points and
+    // intervals are recorded along world_ray (same t), with material mat and the given priority
+    bool trace(const ray& object_ray, const ray& world_ray, float t_min, float t_max, hit_record& rec,
+               const material* mat, int priority) const;
+    void trace_packet(const ray_packet& object_packet, const ray_packet& world_packet, float t_min, float t_max,
+                      hit_record* recs, bool* hits, const material* mat, int priority) const;
 
-    void clear() { objects.clear(); }
-    void add(shared_ptr<hittable> object) { objects.push_back(object); }
+    void clear() { triangles.clear(); tree = bvh(); wide_tree = wide_bvh(); }
+    void add(const vec3& v0, const vec3& v1, const vec3& v2) { triangles.add(v0, v1, v2); }
 
 public:
     shared_ptr<material> mat_ptr;
-    std::vector<shared_ptr<hittable>> objects;
+    triangle_store triangles; // in leaf order of tree once it is built
+    bvh tree; // acceleration structure over triangles, empty once wide_tree is made from it
+    wide_bvh wide_tree;
     vec3 pos;
+
+private:
+    // Records the crossings of r with this mesh and the intervals between them, false when there are none
+    static bool record_crossings(const ray& r, small_vector<float, max_inline_hits>& t_hits, hit_record& rec,
+                                 const material* mat, int priority);
+
+    struct load_settings {
+        bool streaming = true;
+        size_t chunk_triangles = 1 << 16;
+        bool wide_trees = true;
+    };
+    static load_settings& settings() {
+        static load_settings s;
+        return s;
+    }
+
+    static bool same_point(const vec3& a, const vec3& b) { return a.x() == b.x() && a.y() == b.y() && a.z() == b.z(); }
+
+    void read(const char* filename) {
+        if (settings().streaming) stream_obj(filename);
+        else read_obj(filename);
+    }
+
+    // welded STL vertices and corner indices, only kept from read_obj until the cache is written
+    std::vector<float> stl_vertices;
+    std::vector<unsigned int> stl_indices;
 };
 
+void mesh::load(const char* filename) {
+    bool cached = false;
+    if (mesh_cache::enabled()) {
+        mesh_cache cache(filename);
+        cached = cache.read(triangles, tree);
+        if (!cached) {
+            read(filename);
+            build_bvh();
+            if (!triangles.empty()) cache.write(stl_vertices, stl_indices, triangles, tree);
+        }
+    }
+    else {
+        read(filename);
+        build_bvh();
+    }
+    if (!cached && !tree.empty()) {
+        bvh_stats stats = tree.statistics();
+        std::cout << "BVH of " << filename << ": " << triangles.size() << " triangles, " << stats.nodes << " nodes ("
+                  << stats.leaves << " leaves), depth " << stats.depth << ", SAH cost " << stats.sah_cost
+                  << ", built in " << stats.build_seconds << " s" << std::endl;
+    }
+    std::vector<float>().swap(stl_vertices);
+    std::vector<unsigned int>().swap(stl_indices);
+
+    // geometry is built and cached in object space, then placed in the world
+    triangles.translate(pos);
+    tree.translate(pos);
+    if (settings().wide_trees && wide_tree.build(tree)) {
+        tree = bvh(); // its leaf ranges live on in wide_tree, and prim_indices is the identity
+    }
+}
+
 void mesh::read_obj(const char* filename) {
     try {
         stl_reader::StlMesh<float, unsigned int> mesh (filename);
 
+        triangles.reserve(triangles.size() + mesh.num_tris());
         for (int i = 0; i < mesh.num_tris(); i++) {
-            vec3 v0 = vectortoVec3(mesh.tri_corner_coords(i, 0)) + pos;
-            vec3 v1 = vectortoVec3(mesh.tri_corner_coords(i, 1)) + pos;
-            vec3 v2 = vectortoVec3(mesh.tri_corner_coords(i, 2)) + pos;
-            add(make_shared<triangle>(v0, v1, v2, mat_ptr));
+            vec3 v0 = vectortoVec3(mesh.tri_corner_coords(i, 0));
+            vec3 v1 = vectortoVec3(mesh.tri_corner_coords(i, 1));
+            vec3 v2 = vectortoVec3(mesh.tri_corner_coords(i, 2));
+            add(v0, v1, v2);
+        }
+
+        if (mesh.num_tris() > 0) {
+            stl_vertices.assign(mesh.raw_coords(), mesh.raw_coords() + 3 * mesh.num_vrts());
+            stl_indices.assign(mesh.raw_tris(), mesh.raw_tris() + 3 * mesh.num_tris());
         }
     }
     catch (const std::exception &e) {
@@ -45,26 +143,132 @@ void mesh::read_obj(const char* filename) {
     }
 }
 
+void mesh::stream_obj(const char* filename) {
+    size_t first = triangles.size();
+    try {
+        stl_stream stream(filename, settings().chunk_triangles);
+
+        // an upper estimate for ASCII files, the unused capacity is never touched and reorder() trims it
+        triangles.reserve(triangles.size() + stream.size_hint());
+        std::vector<float> corners;
+        while (stream.next(corners)) {
+            for (size_t i = 0; i < corners.size(); i += 9) {
+                vec3 v0(corners[i], corners[i + 1], corners[i + 2]);
+                vec3 v1(corners[i + 3], corners[i + 4], corners[i + 5]);
+                vec3 v2(corners[i + 6], corners[i + 7], corners[i + 8]);
+                if (same_point(v0, v1) || same_point(v1, v2) || same_point(v2, v0)) continue; // welds to a line
+                add(v0, v1, v2);
+            }
+        }
+    }
+    catch (const std::exception &e) {
+        triangles.truncate(first); // a broken file adds nothing, as in read_obj
+        std::cerr << e.what() << std::endl;
+    }
+}
+
+void mesh::build_bvh() {
+    // the builder takes each triangle's box straight from the store, no list of boxes is made here
+    wide_tree = wide_bvh(); // it would not cover the new triangles
+    tree.build(triangles.size(), [this](int i) { return triangles.bounding_box(i); });
+
+    // store the triangles in leaf order, so each leaf is one contiguous run of the arrays
+    triangles.reorder(tree.prim_indices);
+    if (stl_indices.size() == 3 * tree.prim_indices.size()) {
+        std::vector<unsigned int> reordered(stl_indices.size());
+        for (int i = 0; i < tree.prim_indices.size(); i++) {
+            for (int c = 0; c < 3; c++) {
+                reordered[3 * i + c] = stl_indices[3 * tree.prim_indices[i] + c];
+            }
+        }
+        stl_indices.swap(reordered);
+    }
+    for (int i = 0; i < tree.prim_indices.size(); i++) {
+        tree.prim_indices[i] = i;
+    }
+}
+
+bool mesh::bounding_box(aabb &output_box) const {
+    if (!has_tree()) return false;
+    output_box = wide_tree.empty() ? tree.bounds() : wide_tree.bounds();
+    return true;
+}
+
 bool mesh::hit(const ray &r, float t_min, float t_max, hit_record &rec) const {
-    bool is_hit = false;
-    hit_record mesh_rec;
-    float d = 0; // d is used to store the distance travelled through the object
+    return trace(r, r, t_min, t_max, rec, mat_ptr.get(), priority);
+}
 
-    for (const auto &object: objects) {
-        if (object->hit(r, t_min, t_max, mesh_rec)) {
-            is_hit = true;
+void mesh::hit_packet(const ray_packet& packet, float t_min, float t_max, hit_record* recs, bool* hits) const {
+    trace_packet(packet, packet, t_min, t_max, recs, hits, mat_ptr.get(), priority);
+}
+
+bool mesh::trace(const ray& object_ray, const ray& world_ray, float t_min, float t_max, hit_record& rec,
+                 const material* mat, int priority) const {
+    small_vector<float, max_inline_hits> t_hits; // crossings of this mesh only
+
+    // only triangles in leaves crossed by the ray are tested, every crossing is still recorded
+    auto visit = [&](int first, int count) {
+        intersect_range(triangles, first, count, object_ray, t_min, t_max, [&](size_t, float t) {
+            t_hits.push_back(t);
+        });
+    };
+    if (!wide_tree.empty()) wide_tree.traverse_leaves(object_ray, t_min, t_max, visit);
+    else tree.traverse_leaves(object_ray, t_min, t_max, visit);
+
+    return record_crossings(world_ray, t_hits, rec, mat, priority);
+}
+
+void mesh::trace_packet(const ray_packet& packet, const ray_packet& world_packet, float t_min, float t_max,
+                        hit_record* recs, bool* hits, const material* mat, int priority) const {
+    small_vector<float, max_inline_hits> t_hits[ray_packet::max_size];
+
+    auto visit = [&](int first, int count, uint64_t mask) {
+        if (__builtin_popcountll(mask) < packet_lane_width) {
+            // too few rays left to fill the lanes, test the leaf triangles across one ray at a time instead
+            for (; mask; mask &= mask - 1) {
+                int ray_index = __builtin_ctzll(mask);
+                intersect_range(triangles, first, count, packet.rays[ray_index], t_min, t_max, [&](size_t, float t) {
+                    t_hits[ray_index].push_back(t);
+                });
+            }
+            return;
         }
+
+        float t_lanes[packet_lane_width];
+        for (int i = first; i < first + count; i++) {
+            for (int lane = 0; lane < packet.size; lane += packet_lane_width) {
+                uint64_t lanes = (mask >> lane) & ((uint64_t(1) << packet_lane_width) - 1);
+                if (!lanes) continue;
+                for (unsigned crossed = intersect_packet(triangles, i, packet, lane, t_min, t_max, t_lanes) & lanes;
+                     crossed; crossed &= crossed - 1) {
+                    int k = __builtin_ctz(crossed);
+                    t_hits[lane + k].push_back(t_lanes[k]);
+                }
+            }
+        }
+    };
+    if (!wide_tree.empty()) wide_tree.traverse_packet(packet, t_min, t_max, visit);
+    else tree.traverse_packet(packet, t_min, t_max, visit);
+
+    for (int i = 0; i < packet.size; i++) {
+        hits[i] = record_crossings(world_packet.rays[i], t_hits[i], recs[i], mat, priority);
     }
+}
 
-    if (!is_hit) return false; // if no object is hit, return false
+bool mesh::record_crossings(const ray& r, small_vector<float, max_inline_hits>& t_hits, hit_record& rec,
+                            const material* mat, int priority) {
+    if (t_hits.empty()) return false; // if no object is hit, return false
 
-    sort(mesh_rec.t.begin(), mesh_rec.t.end());  // sort the hit points from smallest to largest
+    sort(t_hits.begin(), t_hits.end());  // sort the hit points from smallest to largest
     int inc = 2;
-    for (int i = 0; i < mesh_rec.t.size(); i+=inc) {
-        d += r.diff(mesh_rec.t[i], mesh_rec.t[i + 1]);  // calculate the distance travelled through section of object and add to d
+    for (int i = 0; i + 1 < t_hits.size(); i+=inc) { // an unpaired last crossing (grazing hit) adds nothing
+        rec.intervals.push_back({mat, t_hits[i], t_hits[i + 1], priority, 1}); // inside between an entry and an exit
+    }
+
+    for (float t: t_hits) {
+        rec.t.push_back(t);
+        rec.p.push_back(r.at(t));
     }
-    mesh_rec.trans_prob = mat_ptr->transmission(d);  // calculate the transmission probability
-    rec = mesh_rec; // update the hit_record
     return true;
 }
 #endif //MESH_H
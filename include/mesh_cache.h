@@ -0,0 +1,228 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include "bvh.h"
+#include "mapped_file.h"
+#include "triangle_store.h"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Preprocessed form of an STL mesh: welded vertices, the triangle index array, the triangle_store columns and
+// the BVH nodes, all in object space and in leaf order. It is written next to the STL (or into the cache
+// directory) the first time a mesh is loaded and memory-mapped on later runs. The size and modification time of
+// the STL in the header show it is unchanged without reading it; when they differ, a hash of the STL bytes
+// decides whether the cache is stale. Meshes loaded by streaming are never welded, their cache has no vertices
+// and indices.
+struct mesh_cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t node_size;     // sizeof(bvh_node) when written, guards against layout changes
+    uint64_t source_hash;   // FNV-1a of the STL file
+    uint64_t source_size;
+    uint64_t source_mtime;  // modification time of the STL [ns since the epoch]
+    uint64_t num_vertices;
+    uint64_t num_triangles;
+    uint64_t num_nodes;
+    uint64_t vertices_offset;  // num_vertices * 3 floats
+    uint64_t indices_offset;   // num_triangles * 3 uint32
+    uint64_t triangles_offset; // 9 columns of num_triangles floats, in triangle_store order
+    uint64_t nodes_offset;     // num_nodes bvh_node
+};
+
+class mesh_cache {
+public:
+    static const uint32_t version = 3; // 2: SAH trees, 3: source_mtime
+
+    static void set_enabled(bool enabled) { settings().enabled = enabled; }
+    static bool enabled() { return settings().enabled; }
+    static void set_directory(const string& directory) { settings().directory = directory; } // empty: next to the STL
+
+    explicit mesh_cache(const string& source_filename);
+
+    const string& path() const { return cache_path; }
+
+    // Fills tris and tree from the cache, false when it is missing or stale
+    bool read(triangle_store& tris, bvh& tree) const;
+    void write(const std::vector<float>& vertices, const std::vector<unsigned int>& indices,
+               const triangle_store& tris, const bvh& tree) const;
+
+private:
+    struct cache_settings {
+        bool enabled = true;
+        string directory;
+    };
+    static cache_settings& settings() {
+        static cache_settings s;
+        return s;
+    }
+
+    string source_path, cache_path;
+    uint64_t source_size = 0;
+    uint64_t source_mtime = 0;
+    bool have_source = false;
+    mutable uint64_t source_hash = 0;
+    mutable bool hashed = false;
+
+    uint64_t hash_source() const; // reads the whole STL the first time
+    static uint64_t fnv1a(const char* data, size_t size, uint64_t hash); // continues hash over data
+    static uint64_t align(uint64_t offset) { return (offset + 63) & ~uint64_t(63); }
+};
+
+uint64_t mesh_cache::fnv1a(const char* data, size_t size, uint64_t hash) {
+    for (size_t i = 0; i < size; i++) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+mesh_cache::mesh_cache(const string& source_filename) : source_path(source_filename) {
+    string directory = settings().directory;
+    if (directory.empty()) {
+        cache_path = source_filename + ".xrtc";
+    }
+    else {
+        size_t slash = source_filename.find_last_of('/');
+        string base = slash == string::npos ? source_filename : source_filename.substr(slash + 1);
+        cache_path = directory + (directory.back() == '/' ? "" : "/") + base + ".xrtc";
+    }
+
+    struct stat info;
+    if (::stat(source_filename.c_str(), &info) == 0 && S_ISREG(info.st_mode)) {
+        source_size = info.st_size;
+        source_mtime = uint64_t(info.st_mtim.tv_sec) * 1000000000ull + info.st_mtim.tv_nsec;
+        have_source = true;
+    }
+}
+
+uint64_t mesh_cache::hash_source() const {
+    if (hashed) return source_hash;
+
+    // hashed a window at a time, dropping the pages behind, so large STLs do not stay resident
+    source_hash = 14695981039346656037ull;
+    mapped_file source(source_path);
+    if (source.is_open()) {
+        const size_t window = size_t(16) << 20;
+        for (size_t offset = 0; offset < source.size(); offset += window) {
+            size_t size = std::min(window, source.size() - offset);
+            source_hash = fnv1a(source.data() + offset, size, source_hash);
+            source.release(offset, size);
+        }
+    }
+    hashed = true;
+    return source_hash;
+}
+
+bool mesh_cache::read(triangle_store& tris, bvh& tree) const {
+    if (!have_source) return false;
+
+    mapped_file file(cache_path);
+    if (!file.is_open() || file.size() < sizeof(mesh_cache_header)) return false;
+
+    mesh_cache_header header;
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (std::memcmp(header.magic, "XRTMESH", 8) != 0 || header.version != version ||
+        header.node_size != sizeof(bvh_node) || header.source_size != source_size) return false;
+    if (header.source_mtime != source_mtime) {
+        // touched or copied, only stale if the bytes changed; the new time saves the hash on later runs
+        if (header.source_hash != hash_source()) return false;
+        std::fstream update(cache_path, std::ios::in | std::ios::out | std::ios::binary);
+        update.seekp(offsetof(mesh_cache_header, source_mtime));
+        update.write(reinterpret_cast<const char*>(&source_mtime), sizeof(source_mtime));
+    }
+
+    // a truncated or corrupt cache must not be read past its end
+    auto fits = [&](uint64_t offset, uint64_t count, uint64_t item_size) {
+        return offset <= file.size() && count <= (file.size() - offset) / item_size;
+    };
+    if (!fits(header.triangles_offset, header.num_triangles, 9 * sizeof(float)) ||
+        !fits(header.nodes_offset, header.num_nodes, sizeof(bvh_node))) return false;
+
+    tris.assign_columns(reinterpret_cast<const float*>(file.data() + header.triangles_offset), header.num_triangles);
+
+    const bvh_node *nodes = reinterpret_cast<const bvh_node*>(file.data() + header.nodes_offset);
+    tree.nodes.assign(nodes, nodes + header.num_nodes);
+    tree.prim_indices.resize(header.num_triangles);
+    for (size_t i = 0; i < header.num_triangles; i++) {
+        tree.prim_indices[i] = static_cast<int>(i); // triangles are stored in leaf order
+    }
+    return true;
+}
+
+void mesh_cache::write(const std::vector<float>& vertices, const std::vector<unsigned int>& indices,
+                       const triangle_store& tris, const bvh& tree) const {
+    if (!have_source) return;
+
+    mesh_cache_header header = {};
+    std::memcpy(header.magic, "XRTMESH", 8);
+    header.version = version;
+    header.node_size = sizeof(bvh_node);
+    header.source_hash = hash_source();
+    header.source_size = source_size;
+    header.source_mtime = source_mtime;
+    header.num_vertices = vertices.size() / 3;
+    header.num_triangles = tris.size();
+    header.num_nodes = tree.nodes.size();
+    header.vertices_offset = align(sizeof(header));
+    header.indices_offset = align(header.vertices_offset + vertices.size() * sizeof(float));
+    header.triangles_offset = align(header.indices_offset + indices.size() * sizeof(unsigned int));
+    header.nodes_offset = align(header.triangles_offset + 9 * tris.size() * sizeof(float));
+
+    // write to a temporary file of this writer only (created exclusively, named by pid and a random number)
+    // and rename it, so concurrent runs never write the same file and a reader never maps a half written one
+    string temp_path;
+    int fd = -1;
+    std::random_device random;
+    for (int attempt = 0; fd < 0 && attempt < 16; attempt++) {
+        temp_path = cache_path + ".tmp." + std::to_string(getpid()) + "." + std::to_string(random());
+        fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+        if (fd < 0 && errno != EEXIST) break;
+    }
+    if (fd < 0) {
+        std::cerr << "Could not write mesh cache " << cache_path << std::endl;
+        return;
+    }
+    ::close(fd);
+    std::ofstream file(temp_path, std::ios::binary);
+    if (!file) {
+        std::cerr << "Could not write mesh cache " << cache_path << std::endl;
+        std::remove(temp_path.c_str());
+        return;
+    }
+
+    auto write_at = [&](uint64_t offset, const void* data, size_t bytes) {
+        static const char zeros[64] = {};
+        file.write(zeros, offset - static_cast<uint64_t>(file.tellp())); // alignment gap
+        file.write(static_cast<const char*>(data), bytes);
+    };
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    write_at(header.vertices_offset, vertices.data(), vertices.size() * sizeof(float));
+    write_at(header.indices_offset, indices.data(), indices.size() * sizeof(unsigned int));
+    const std::vector<float>* columns[9] = {&tris.v0x, &tris.v0y, &tris.v0z, &tris.e1x, &tris.e1y, &tris.e1z,
+                                            &tris.e2x, &tris.e2y, &tris.e2z};
+    write_at(header.triangles_offset, nullptr, 0);
+    for (auto column: columns) {
+        file.write(reinterpret_cast<const char*>(column->data()), tris.size() * sizeof(float));
+    }
+    write_at(header.nodes_offset, tree.nodes.data(), tree.nodes.size() * sizeof(bvh_node));
+    file.close();
+
+    if (!file || std::rename(temp_path.c_str(), cache_path.c_str()) != 0) {
+        std::cerr << "Could not write mesh cache " << cache_path << std::endl;
+        std::remove(temp_path.c_str());
+    }
+}
+
+#endif //MESH_CACHE_H
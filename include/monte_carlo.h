@@ -0,0 +1,249 @@
+#ifndef MONTE_CARLO_H
+#define MONTE_CARLO_H
+
+#include "camera.h"
+#include "detector.h"
+#include "framebuffer.h"
+#include "hittable.h"
+#include "json.h"
+#include "philox.h"
+#include "spectrum.h"
+#include "thread_pool.h"
+#include "transport.h"
+
+#include <atomic>
+#include <iostream>
+
+using nlohmann::json;
+
+// Photon Monte Carlo for the scattered part of the image. Photons leave the source towards uniformly random
+// points of the detector, photons_per_pixel for every pixel, and are followed through the world: free paths
+// from the total mu, then photoabsorption, Compton or Rayleigh scattering as the material samples it, until
+// they are absorbed or leave. Those reaching the detector after at least one scatter are tallied; the
+// unscattered ones make up the primary image, which the renderer has already traced, so only the scatter is
+// added to it, normalised the same way (1 = the unattenuated beam).
+//
+// Photon n of view k always draws from Philox stream n under a key made from the seed and k, so the image
+// does not depend on the number of threads. Each thread tallies into its own framebuffer.
+class scatter_simulation {
+public:
+    // "scatter" section of the config: photons_per_pixel, seed, energy [keV] of the source when there is no
+    // spectrum, max_interactions per photon
+    explicit scatter_simulation(const json& config);
+
+    // Adds the scatter reaching the detector to image, photons weighted by the detector's response when one is
+    // given. view numbers the projection, each has its own streams.
+    void run(thread_pool& pool, const camera& cam, const hittable& world, const spectrum* source,
+             const detector* response, framebuffer& image, uint64_t view = 0) const;
+
+public:
+    float photons_per_pixel;
+    uint64_t seed;
+    float energy;
+    int max_interactions;
+
+private:
+    static const size_t batch_size = 1024; // photons per task
+
+    // Follows one photon until it is absorbed or leaves, true with its pixel and energy e [keV] if it reaches the
+    // detector scattered
+    bool track(philox_stream& rng, const camera& cam, const hittable& world, const std::vector<float>& cdf,
+               const spectrum* source, int width, int height, int& x, int& y, float& e) const;
+
+    // Cosine of the scattering angle on element atomic_number, Compton also lowers e [keV]
+    static float compton(float& e, int atomic_number, philox_stream& rng);
+    static float rayleigh(float e, int atomic_number, philox_stream& rng);
+
+    static vec3 scatter_direction(const vec3& dir, float cos_theta, float phi);
+};
+
+scatter_simulation::scatter_simulation(const json& config) :
+        photons_per_pixel(config.value("photons_per_pixel", 16.0f)),
+        seed(config.value("seed", static_cast<uint64_t>(1))),
+        energy(config.value("energy", 40.0f)),
+        max_interactions(config.value("max_interactions", 64)) {}
+
+void scatter_simulation::run(thread_pool& pool, const camera& cam, const hittable& world, const spectrum* source,
+                             const detector* response, framebuffer& image, uint64_t view) const {
+    const int width = image.width, height = image.height;
+    const uint64_t photons = static_cast<uint64_t>(photons_per_pixel * width * height);
+    const uint64_t key = seed + view * 0x9E3779B97F4A7C15ull;
+    const size_t batches = (photons + batch_size - 1) / batch_size;
+
+    std::vector<float> cdf; // of the source spectrum, for drawing photon energies
+    if (source) {
+        float total = 0;
+        for (float w: source->weights) cdf.push_back(total += w);
+    }
+
+    // a photon counts its response relative to the mean response to the unattenuated beam, like the primary image
+    float mean_response = 1;
+    if (response) {
+        mean_response = 0;
+        if (source) {
+            for (int i = 0; i < source->size(); i++) mean_response += source->weights[i] * response->response(source->energies[i]);
+        }
+        else {
+            mean_response = response->response(energy);
+        }
+    }
+
+    std::vector<framebuffer> tallies(pool.size(), framebuffer(width, height));
+    std::atomic<size_t> batches_done(0);
+    pool.parallel_for(batches, [&](size_t batch, int thread_id) {
+        framebuffer &tally = tallies[thread_id];
+        uint64_t end = std::min(photons, (batch + 1) * batch_size);
+        for (uint64_t n = batch * batch_size; n < end; n++) {
+            philox_stream rng(key, n);
+            int x, y;
+            float e;
+            if (!track(rng, cam, world, cdf, source, width, height, x, y, e)) continue;
+            tally.at(x, y) += response ? response->response(e) / mean_response : 1;
+        }
+
+        size_t done = ++batches_done;
+        if (thread_id == 0) {
+            std::cerr << "\rScatter batches remaining: " << batches - done << ' ' << std::flush;
+        }
+    });
+    std::cerr << "\rScatter batches remaining: 0 " << std::flush;
+
+    double primary = 0, scattered = 0;
+    for (size_t i = 0; i < image.pixels.size(); i++) {
+        float sum = 0;
+        for (const framebuffer &tally: tallies) sum += tally.pixels[i];
+        primary += image.pixels[i];
+        image.pixels[i] += sum / photons_per_pixel;
+        scattered += sum / photons_per_pixel;
+    }
+    std::cout << "\n<Scatter>\n" << photons << " photons, scatter to primary ratio = " << scattered / primary << "\n"
+              << std::endl;
+}
+
+bool scatter_simulation::track(philox_stream& rng, const camera& cam, const hittable& world,
+                               const std::vector<float>& cdf, const spectrum* source, int width, int height,
+                               int& x, int& y, float& e) const {
+    // a random point on the detector, over the full area of the edge pixels
+    float u = (rng.uniform() * width - 0.5f) / (width - 1);
+    float v = (rng.uniform() * height - 0.5f) / (height - 1);
+    vec3 p = cam.source();
+    vec3 dir = unit_vector(cam.get_ray(u, v).direction());
+    e = energy;
+    if (source) {
+        size_t bin = std::upper_bound(cdf.begin(), cdf.end(), rng.uniform() * cdf.back()) - cdf.begin();
+        e = source->energies[std::min(bin, cdf.size() - 1)];
+    }
+
+    for (int interactions = 0; ; interactions++) {
+        // the whole line is traced, so objects the photon is inside are seen as well
+        hit_record rec;
+        const material *mat = nullptr;
+        float t_interaction = 0;
+        float optical_depth = -std::log(1 - rng.uniform());
+        if (world.hit(ray(p, dir), -infinity, infinity, rec)) {
+            // each stretch has its own mu, a density volume gives one per run of equal voxels, so interactions
+            // follow the matter in it and never fall in its empty voxels
+            const material *last = nullptr;
+            float mu_material = 0; // of last, density volumes cross many stretches of one material
+            for_each_stretch(rec, [&](const path_interval& in, float t0, float t1) {
+                t0 = std::max(t0, 0.0f);
+                if (!(t1 > t0)) return true;
+                if (in.mat != last) {
+                    last = in.mat;
+                    mu_material = in.mat->attenuation_at(e);
+                }
+                float mu = mu_material * in.scale;
+                float depth = mu * (t1 - t0);
+                if (optical_depth < depth) {
+                    mat = in.mat;
+                    t_interaction = t0 + optical_depth / mu;
+                    return false;
+                }
+                optical_depth -= depth;
+                return true;
+            });
+        }
+
+        if (!mat) {
+            if (interactions == 0) return false; // primary photon
+            float du, dv;
+            if (!cam.detector_coordinates(p, dir, du, dv)) return false;
+            x = static_cast<int>(std::lround(du * (width - 1)));
+            y = height - 1 - static_cast<int>(std::lround(dv * (height - 1))); // framebuffer rows run top to bottom
+            return x >= 0 && x < width && y >= 0 && y < height;
+        }
+        if (interactions == max_interactions) return false;
+
+        p += t_interaction * dir;
+        int atomic_number = 0;
+        float cos_theta;
+        switch (mat->sample_interaction(e, rng.uniform(), atomic_number)) {
+            case cross_sections::compton:
+                cos_theta = compton(e, atomic_number, rng);
+                break;
+            case cross_sections::rayleigh:
+                cos_theta = rayleigh(e, atomic_number, rng);
+                break;
+            default:
+                return false; // photoabsorption, fluorescence is not followed
+        }
+        if (e < cross_sections::e_min * 1E3) return false;
+        dir = scatter_direction(dir, cos_theta, 2 * pi * rng.uniform());
+    }
+}
+
+float scatter_simulation::compton(float& e, int atomic_number, philox_stream& rng) {
+    // Klein–Nishina by the Butcher and Messel mixture (as in Geant4), the same rejection step also accepts with
+    // probability S(q) / Z
+    const float kappa = e / 510.99895f;
+    const float eps0 = 1 / (1 + 2 * kappa), eps0_sq = eps0 * eps0;
+    const float alpha1 = -std::log(eps0), alpha2 = alpha1 + 0.5f * (1 - eps0_sq);
+    const double ak = cross_sections::screening_length(atomic_number) * cross_sections::wave_number(e / 1E3);
+    while (true) {
+        float eps, eps_sq;
+        if (alpha1 > alpha2 * rng.uniform()) {
+            eps = std::exp(-alpha1 * rng.uniform());
+            eps_sq = eps * eps;
+        }
+        else {
+            eps_sq = eps0_sq + (1 - eps0_sq) * rng.uniform();
+            eps = std::sqrt(eps_sq);
+        }
+        float one_minus_cos = (1 - eps) / (eps * kappa);
+        float sin_sq = one_minus_cos * (2 - one_minus_cos);
+        float g = 1 - eps * sin_sq / (1 + eps_sq);
+        float s_over_z = 1 - static_cast<float>(cross_sections::form_factor_squared(2 * ak * ak * one_minus_cos));
+        if (g * s_over_z >= rng.uniform()) {
+            e *= eps;
+            return 1 - one_minus_cos;
+        }
+    }
+}
+
+float scatter_simulation::rayleigh(float e, int atomic_number, philox_stream& rng) {
+    // s = 1 - cos theta drawn from F^2 ~ (1 + c s)^-4 by inversion, then Thomson's (1 + cos^2) / 2 by rejection
+    const double ak = cross_sections::screening_length(atomic_number) * cross_sections::wave_number(e / 1E3);
+    const double c = 2 * ak * ak;
+    const double tail = 1 - 1 / ((1 + 2 * c) * (1 + 2 * c) * (1 + 2 * c));
+    while (true) {
+        double s = (1 / std::cbrt(1 - rng.uniform() * tail) - 1) / c;
+        float cos_theta = std::max(-1.0f, std::min(1.0f, static_cast<float>(1 - s)));
+        if (0.5f * (1 + cos_theta * cos_theta) >= rng.uniform()) return cos_theta;
+    }
+}
+
+vec3 scatter_simulation::scatter_direction(const vec3& dir, float cos_theta, float phi) {
+    // in double, the division by r loses too much near the poles in float
+    double sin_theta = std::sqrt(std::max(0.0, 1.0 - static_cast<double>(cos_theta) * cos_theta));
+    double cos_phi = std::cos(phi), sin_phi = std::sin(phi);
+    double dx = dir.x(), dy = dir.y(), dz = dir.z();
+    double r = std::sqrt(dx * dx + dy * dy);
+    if (r < 1e-6) {
+        return vec3(sin_theta * cos_phi, sin_theta * sin_phi, dz > 0 ? cos_theta : -cos_theta);
+    }
+    return unit_vector(vec3(sin_theta * (dx * dz * cos_phi - dy * sin_phi) / r + dx * cos_theta,
+                            sin_theta * (dy * dz * cos_phi + dx * sin_phi) / r + dy * cos_theta,
+                            -sin_theta * cos_phi * r + dz * cos_theta));
+}
+
+#endif //MONTE_CARLO_H
@@ -0,0 +1,62 @@
+#ifndef PHILOX_H
+#define PHILOX_H
+
+#include <cstdint>
+
+// Philox4x32-10 counter based generator (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3"). Each
+// output block is a pure function of the key and a counter, so a stream needs no state beyond its number:
+// every photon gets the stream numbered by its index, and draws the same values whichever thread traces it.
+class philox_stream {
+public:
+    philox_stream(uint64_t seed, uint64_t stream) :
+            key{static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32)},
+            counter{static_cast<uint32_t>(stream), static_cast<uint32_t>(stream >> 32), 0, 0} {}
+
+    uint32_t next_uint() {
+        if (used == 4) {
+            generate();
+            used = 0;
+        }
+        return block[used++];
+    }
+
+    // Uniform in [0, 1)
+    float uniform() { return (next_uint() >> 8) * (1.0f / 16777216.0f); }
+
+    // Block for counter and key without a stream object, used to check against the reference values
+    static void generate(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4]);
+
+private:
+    uint32_t key[2];
+    uint32_t counter[4]; // photon index in the first two words, block number in the third
+    uint32_t block[4];
+    int used = 4;
+
+    void generate() {
+        generate(counter, key, block);
+        if (++counter[2] == 0) counter[3]++;
+    }
+};
+
+void philox_stream::generate(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4]) {
+    uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+    uint32_t k0 = key[0], k1 = key[1];
+    for (int round = 0; round < 10; round++) {
+        uint64_t p0 = static_cast<uint64_t>(0xD2511F53u) * c0;
+        uint64_t p1 = static_cast<uint64_t>(0xCD9E8D57u) * c2;
+        uint32_t n0 = static_cast<uint32_t>(p1 >> 32) ^ c1 ^ k0;
+        uint32_t n2 = static_cast<uint32_t>(p0 >> 32) ^ c3 ^ k1;
+        c1 = static_cast<uint32_t>(p1);
+        c3 = static_cast<uint32_t>(p0);
+        c0 = n0;
+        c2 = n2;
+        k0 += 0x9E3779B9u;
+        k1 += 0xBB67AE85u;
+    }
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+}
+
+#endif //PHILOX_H
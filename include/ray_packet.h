@@ -0,0 +1,95 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include "ray.h"
+#include "aabb.h"
+
+#include <cstdint>
+
+// Lane width of the packet kernels, the same instruction set choice as triangle_simd.h
+#if defined(__AVX2__) && !defined(XRT_NO_SIMD)
+#include <immintrin.h>
+const int packet_lane_width = 8;
+#elif defined(__SSE2__) && !defined(XRT_NO_SIMD)
+#include <emmintrin.h>
+const int packet_lane_width = 4;
+#else
+const int packet_lane_width = 1;
+#endif
+
+// Up to 64 coherent rays (an 8x8 block of pixels) traced together. Bit i of a ray mask stands for ray i. The
+// rays are also kept as columns, padded to a whole number of lanes, so the kernels test packet_lane_width rays
+// per instruction.
+struct ray_packet {
+    static const int max_size = 64;
+
+    ray rays[max_size];
+    int size = 0;
+
+    alignas(32) float ox[max_size], oy[max_size], oz[max_size];
+    alignas(32) float dx[max_size], dy[max_size], dz[max_size];
+    alignas(32) float ix[max_size], iy[max_size], iz[max_size]; // 1 / direction
+
+    void clear() { size = 0; }
+    void add(const ray& r) { rays[size++] = r; }
+
+    // Fills the columns, must be called after the last add()
+    void finalize() {
+        for (int i = 0; i < max_size; i++) {
+            const ray &r = rays[i < size ? i : size - 1]; // padding lanes repeat the last ray and are masked off
+            ox[i] = r.orig.x(); oy[i] = r.orig.y(); oz[i] = r.orig.z();
+            dx[i] = r.dir.x(); dy[i] = r.dir.y(); dz[i] = r.dir.z();
+            ix[i] = 1.0f / dx[i]; iy[i] = 1.0f / dy[i]; iz[i] = 1.0f / dz[i];
+        }
+    }
+
+    uint64_t all() const { return size == max_size ? ~uint64_t(0) : (uint64_t(1) << size) - 1; }
+};
+
+// Tests the rays of mask against box within [t_min, t_max], returns the rays that cross it. Same arithmetic
+// as aabb::hit, so a ray crosses the same nodes in a packet as on its own.
+inline uint64_t box_hit_packet(const aabb& box, const ray_packet& packet, uint64_t mask, float t_min, float t_max) {
+    uint64_t result = 0;
+    for (int first = 0; first < packet.size; first += packet_lane_width) {
+        const uint64_t lanes = (mask >> first) & ((uint64_t(1) << packet_lane_width) - 1);
+        if (!lanes) continue; // no active ray in this block
+
+#if defined(__AVX2__) && !defined(XRT_NO_SIMD)
+        __m256 near = _mm256_set1_ps(t_min), far = _mm256_set1_ps(t_max);
+        const float *origin[3] = {packet.ox + first, packet.oy + first, packet.oz + first};
+        const float *inv_dir[3] = {packet.ix + first, packet.iy + first, packet.iz + first};
+        for (int a = 0; a < 3; a++) {
+            __m256 o = _mm256_load_ps(origin[a]), inv = _mm256_load_ps(inv_dir[a]);
+            __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(box.minimum[a]), o), inv);
+            __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(box.maximum[a]), o), inv);
+            __m256 negative = _mm256_cmp_ps(inv, _mm256_setzero_ps(), _CMP_LT_OQ);
+            __m256 entry = _mm256_blendv_ps(t0, t1, negative), exit = _mm256_blendv_ps(t1, t0, negative);
+            near = _mm256_max_ps(entry, near); // NaN slabs keep the previous bound, like the scalar test
+            far = _mm256_min_ps(exit, far);
+        }
+        uint64_t hits = _mm256_movemask_ps(_mm256_cmp_ps(far, near, _CMP_GE_OQ));
+#elif defined(__SSE2__) && !defined(XRT_NO_SIMD)
+        __m128 near = _mm_set1_ps(t_min), far = _mm_set1_ps(t_max);
+        const float *origin[3] = {packet.ox + first, packet.oy + first, packet.oz + first};
+        const float *inv_dir[3] = {packet.ix + first, packet.iy + first, packet.iz + first};
+        for (int a = 0; a < 3; a++) {
+            __m128 o = _mm_load_ps(origin[a]), inv = _mm_load_ps(inv_dir[a]);
+            __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(box.minimum[a]), o), inv);
+            __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(box.maximum[a]), o), inv);
+            __m128 negative = _mm_cmplt_ps(inv, _mm_setzero_ps());
+            __m128 entry = _mm_or_ps(_mm_and_ps(negative, t1), _mm_andnot_ps(negative, t0));
+            __m128 exit = _mm_or_ps(_mm_and_ps(negative, t0), _mm_andnot_ps(negative, t1));
+            near = _mm_max_ps(entry, near); // NaN slabs keep the previous bound, like the scalar test
+            far = _mm_min_ps(exit, far);
+        }
+        uint64_t hits = _mm_movemask_ps(_mm_cmpge_ps(far, near));
+#else
+        const ray &r = packet.rays[first];
+        uint64_t hits = box.hit(r.orig, vec3(packet.ix[first], packet.iy[first], packet.iz[first]), t_min, t_max);
+#endif
+        result |= (hits & lanes) << first;
+    }
+    return result;
+}
+
+#endif //RAY_PACKET_H
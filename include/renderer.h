@@ -0,0 +1,375 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include "antialiasing.h"
+#include "camera.h"
+#include "focal_spot.h"
+#include "framebuffer.h"
+#include "hittable.h"
+#include "monte_carlo.h"
+#include "sampling.h"
+#include "spectrum.h"
+#include "thread_pool.h"
+#include "transport.h"
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+
+// Spectrum weighted Beer–Lambert: sum over bins of w_b * exp(-sum_i mu_i(E_b) * d_i). Path lengths through the
+// same material are merged first, then each material adds its optical depth to every bin in one pass.
+float spectral_transmission(const spectrum& source, const small_vector<path_segment, max_inline_hits>& segments) {
+    small_vector<path_segment, max_inline_hits> per_material;
+    for (const path_segment &s: segments) {
+        bool merged = false;
+        for (path_segment &m: per_material) {
+            if (m.mat == s.mat) {
+                m.length += s.length;
+                merged = true;
+                break;
+            }
+        }
+        if (!merged) per_material.push_back(s);
+    }
+
+    const int bins = static_cast<int>(source.size());
+    float optical_depth[max_spectrum_bins];
+    for (int b = 0; b < bins; b++) optical_depth[b] = 0;
+    for (const path_segment &m: per_material) {
+        const float *mu = m.mat->spectral_mu().data();
+        for (int b = 0; b < bins; b++) {
+            optical_depth[b] += mu[b] * m.length;
+        }
+    }
+
+    float transmitted = 0;
+    for (int b = 0; b < bins; b++) {
+        transmitted += source.weights[b] * std::exp(-optical_depth[b]);
+    }
+    return transmitted;
+}
+
+// Transmitted intensity of a traced ray r, source is null for the monoenergetic (effective energy) model
+float record_intensity(const ray& r, bool hit, hit_record& rec, const spectrum* source) {
+    if (hit) {
+        resolve_transport(r, rec);
+        if (source) return spectral_transmission(*source, rec.segments);
+        return rec.trans_prob; // if hit, return the probability of transmission
+    }
+    else {
+        return 1; // if not hit, return 1 (vacuum)
+    }
+}
+
+float ray_intensity(const ray& r, const hittable& world, const spectrum* source = nullptr) {
+    hit_record rec;
+    bool hit = world.hit(r, 0, infinity, rec);
+    return record_intensity(r, hit, rec, source);
+}
+
+struct tile {
+    int x0, y0; // top left pixel
+    int x1, y1; // one past the bottom right pixel
+};
+
+// Renders an image as square tiles spread over a thread pool. Within a tile, blocks of packet_size x
+// packet_size pixels are traced as one ray packet (at most 8x8), a packet size of 1 traces single rays.
+class renderer {
+public:
+    renderer(int threads, int tile_size, int packet_size = 8) :
+            pool(threads),
+            tile_size(tile_size > 0 ? tile_size : 32),
+            packet_size(std::max(1, std::min(packet_size, 8))) {}
+
+    int threads() const { return pool.size(); }
+
+    // Switches to polyenergetic transport, materials in the world must have called use_spectrum() with it
+    void set_spectrum(const spectrum* s) { source = s; }
+
+    // Adds Monte Carlo scatter to every image rendered, null renders the primary image only
+    void set_scatter(const scatter_simulation* s) { scatter = s; }
+
+    // Weights energies by the detector's response and runs its stages over every image rendered
+    void set_detector(const detector* d) { sensor = d; }
+
+    // Averages pixels over a finite focal spot instead of tracing from a point source
+    void set_focal_spot(const focal_spot* s) { spot = s; }
+
+    // Averages pixels over their area on the detector instead of tracing one ray through each
+    void set_antialiasing(const antialiasing* a) { pixel_area = a; }
+
+    void render(const camera& cam, const hittable& world, framebuffer& image);
+
+    // Renders several views of the same world at once, the tiles of all views share one work queue. first_view
+    // numbers the views within a longer series, each gets its own scatter random streams.
+    void render_views(const std::vector<camera>& cams, const hittable& world, std::vector<framebuffer>& images,
+                      size_t first_view = 0);
+
+private:
+    thread_pool pool;
+    int tile_size;
+    int packet_size;
+    const spectrum* source = nullptr;
+    const scatter_simulation* scatter = nullptr;
+    const detector* sensor = nullptr;
+    const focal_spot* spot = nullptr;
+    const antialiasing* pixel_area = nullptr;
+
+    std::vector<tile> make_tiles(int width, int height) const;
+    void render_tiles(const camera* cams, framebuffer* images, size_t num_views, const hittable& world,
+                      size_t first_view);
+
+    // Pixels whose value steps by more than threshold to a neighbour, grown by radius pixels
+    std::vector<unsigned char> edge_mask(const framebuffer& image, float threshold, int radius);
+
+    // Supersamples the pixels set in mask, then in adaptive anti-aliasing the neighbours of those that changed
+    void refine(const camera& cam, const hittable& world, framebuffer& image, std::vector<unsigned char> mask,
+                const spectrum* weights, uint64_t view);
+
+    // Renders the pixels set in mask again as the average over n points of the focal spot and the pixel's area,
+    // returns the number of pixels
+    size_t supersample(const camera& cam, const hittable& world, framebuffer& image,
+                       const std::vector<unsigned char>& mask, const spectrum* weights, uint64_t view, int n);
+};
+
+std::vector<tile> renderer::make_tiles(int width, int height) const {
+    std::vector<tile> tiles;
+    for (int y = 0; y < height; y += tile_size) {
+        for (int x = 0; x < width; x += tile_size) {
+            tiles.push_back({x, y, std::min(x + tile_size, width), std::min(y + tile_size, height)});
+        }
+    }
+    return tiles;
+}
+
+void renderer::render(const camera& cam, const hittable& world, framebuffer& image) {
+    render_tiles(&cam, &image, 1, world, 0);
+}
+
+void renderer::render_views(const std::vector<camera>& cams, const hittable& world, std::vector<framebuffer>& images,
+                            size_t first_view) {
+    render_tiles(cams.data(), images.data(), images.size(), world, first_view);
+}
+
+void renderer::render_tiles(const camera* cams, framebuffer* images, size_t num_views, const hittable& world,
+                            size_t first_view) {
+    if (num_views == 0) return;
+    std::vector<tile> view_tiles = make_tiles(images[0].width, images[0].height); // every view has the same size
+    size_t num_tiles = view_tiles.size() * num_views;
+    std::atomic<size_t> tiles_done(0);
+
+    // the primary image sees the spectrum weighted by the detector's response
+    spectrum detected;
+    const spectrum *weights = source;
+    if (source && sensor) {
+        detected = sensor->detected_spectrum(*source);
+        weights = &detected;
+    }
+
+    // without the adaptive modes every pixel is supersampled, the one ray per pixel pass is not needed
+    bool spread = spot && spot->enabled(), integrate = pixel_area && pixel_area->enabled();
+    bool everywhere = (spread && !spot->adaptive) || (integrate && !pixel_area->adaptive);
+    bool point_source = !everywhere;
+    if (point_source) pool.parallel_for(num_tiles, [&](size_t index, int thread_id) {
+        const camera &cam = cams[index / view_tiles.size()];
+        framebuffer &image = images[index / view_tiles.size()];
+        const tile &t = view_tiles[index % view_tiles.size()];
+        auto pixel_ray = [&](int x, int y) {
+            auto u = float(x) / (image.width-1);
+            auto v = float(image.height-1 - y) / (image.height-1); // framebuffer rows run top to bottom
+            return cam.get_ray(u, v); // ray from camera to pixel;
+        };
+
+        if (packet_size == 1) {
+            for (int y = t.y0; y < t.y1; y++) {
+                for (int x = t.x0; x < t.x1; x++) {
+                    image.at(x, y) = ray_intensity(pixel_ray(x, y), world, weights);
+                }
+            }
+        }
+        else {
+            ray_packet packet;
+            hit_record recs[ray_packet::max_size]; // once per tile, cleared for every packet
+            bool hits[ray_packet::max_size];
+            for (int py = t.y0; py < t.y1; py += packet_size) {
+                for (int px = t.x0; px < t.x1; px += packet_size) {
+                    int y1 = std::min(py + packet_size, t.y1), x1 = std::min(px + packet_size, t.x1);
+                    packet.clear();
+                    for (int y = py; y < y1; y++) {
+                        for (int x = px; x < x1; x++) {
+                            packet.add(pixel_ray(x, y));
+                        }
+                    }
+                    packet.finalize();
+
+                    for (int i = 0; i < packet.size; i++) recs[i].clear();
+                    world.hit_packet(packet, 0, infinity, recs, hits);
+                    int i = 0;
+                    for (int y = py; y < y1; y++) {
+                        for (int x = px; x < x1; x++, i++) {
+                            image.at(x, y) = record_intensity(packet.rays[i], hits[i], recs[i], weights);
+                        }
+                    }
+                }
+            }
+        }
+
+        size_t done = ++tiles_done;
+        if (thread_id == 0) {
+            std::cerr << "\rTiles remaining: " << num_tiles - done << ' ' << std::flush;
+        }
+    });
+    if (point_source) std::cerr << "\rTiles remaining: 0 " << std::flush;
+
+    for (size_t v = 0; v < num_views; v++) {
+        if (spread || integrate) {
+            framebuffer &image = images[v];
+            std::vector<unsigned char> mask(image.pixels.size(), everywhere);
+            if (!everywhere && spread) {
+                // blur reaches half the penumbra either side of an edge in the point source image
+                aabb box;
+                float pitch = cams[v].detector_width() / (image.width - 1);
+                int radius = 2;
+                if (world.bounding_box(box)) {
+                    float half_penumbra = cams[v].penumbra(box, spot->extent()) / 2 / pitch;
+                    radius = static_cast<int>(std::ceil(std::min(half_penumbra, 64.0f))) + 1;
+                }
+                mask = edge_mask(image, spot->edge_threshold, radius);
+            }
+            if (!everywhere && integrate) {
+                std::vector<unsigned char> edges = edge_mask(image, pixel_area->contrast, 0);
+                for (size_t p = 0; p < mask.size(); p++) mask[p] |= edges[p];
+            }
+            refine(cams[v], world, image, std::move(mask), weights, first_view + v);
+        }
+        if (scatter) scatter->run(pool, cams[v], world, source, sensor, images[v], first_view + v);
+        if (sensor) sensor->process(images[v], pool, first_view + v);
+    }
+}
+
+std::vector<unsigned char> renderer::edge_mask(const framebuffer& image, float threshold, int radius) {
+    const int width = image.width, height = image.height;
+    std::vector<unsigned char> edges(image.pixels.size(), 0), rows(image.pixels.size(), 0), mask(image.pixels.size(), 0);
+    pool.parallel_for(height, [&](size_t row, int) {
+        int y = static_cast<int>(row);
+        for (int x = 0; x < width; x++) {
+            float value = image.at(x, y);
+            bool edge = (x > 0 && std::fabs(value - image.at(x - 1, y)) > threshold) ||
+                        (x + 1 < width && std::fabs(value - image.at(x + 1, y)) > threshold) ||
+                        (y > 0 && std::fabs(value - image.at(x, y - 1)) > threshold) ||
+                        (y + 1 < height && std::fabs(value - image.at(x, y + 1)) > threshold);
+            edges[row * width + x] = edge;
+        }
+    });
+
+    // square dilation, along rows then along columns
+    pool.parallel_for(height, [&](size_t row, int) {
+        const unsigned char *in = &edges[row * width];
+        for (int x = 0, last = -radius - 1; x < width + radius; x++) {
+            if (x < width && in[x]) last = x;
+            if (x - radius >= 0 && x - last <= 2 * radius) rows[row * width + x - radius] = 1;
+        }
+    });
+    pool.parallel_for(height, [&](size_t row, int) {
+        int y0 = std::max(0, static_cast<int>(row) - radius), y1 = std::min(height - 1, static_cast<int>(row) + radius);
+        for (int y = y0; y <= y1; y++) {
+            for (int x = 0; x < width; x++) mask[row * width + x] |= rows[static_cast<size_t>(y) * width + x];
+        }
+    });
+    return mask;
+}
+
+void renderer::refine(const camera& cam, const hittable& world, framebuffer& image, std::vector<unsigned char> mask,
+                      const spectrum* weights, uint64_t view) {
+    const int width = image.width, height = image.height;
+    const int n = std::max(spot && spot->enabled() ? spot->samples : 1,
+                           pixel_area && pixel_area->enabled() ? pixel_area->samples : 1);
+    const bool adaptive = pixel_area && pixel_area->enabled() && pixel_area->adaptive;
+    std::vector<unsigned char> done(mask.size(), 0), moved(mask.size(), 0);
+    size_t total = 0;
+    for (int round = 0; ; round++) {
+        framebuffer before = image;
+        size_t count = supersample(cam, world, image, mask, weights, view, n);
+        total += count;
+        if (!adaptive || count == 0 || round + 1 >= pixel_area->rounds) break;
+
+        // the next round takes the untouched neighbours of every pixel that moved
+        for (size_t p = 0; p < mask.size(); p++) {
+            done[p] |= mask[p];
+            moved[p] = mask[p] && std::fabs(image.pixels[p] - before.pixels[p]) > pixel_area->contrast;
+        }
+        pool.parallel_for(height, [&](size_t row, int) {
+            int y = static_cast<int>(row);
+            for (int x = 0; x < width; x++) {
+                size_t pixel = row * width + x;
+                bool next = false;
+                for (int dy = -1; dy <= 1 && !done[pixel] && !next; dy++) {
+                    for (int dx = -1; dx <= 1; dx++) {
+                        int nx = x + dx, ny = y + dy;
+                        if (nx >= 0 && nx < width && ny >= 0 && ny < height &&
+                            moved[static_cast<size_t>(ny) * width + nx]) {
+                            next = true;
+                            break;
+                        }
+                    }
+                }
+                mask[pixel] = next;
+            }
+        });
+    }
+    std::cerr << "\rSupersampling: " << total << " of " << image.pixels.size() << " pixels " << std::flush;
+}
+
+size_t renderer::supersample(const camera& cam, const hittable& world, framebuffer& image,
+                             const std::vector<unsigned char>& mask, const spectrum* weights, uint64_t view, int n) {
+    // the source takes the first two dimensions of the sample set and the pixel area the next two, or the first
+    // two when there is no focal spot
+    const bool spread = spot && spot->enabled(), integrate = pixel_area && pixel_area->enabled();
+    const int area_dimension = spread ? 2 : 0;
+    std::atomic<size_t> count(0);
+    pool.parallel_for(image.height, [&](size_t row, int) {
+        int y = static_cast<int>(row);
+        ray_packet packet;
+        hit_record recs[ray_packet::max_size]; // once per row, cleared for every packet
+        bool hits[ray_packet::max_size];
+        for (int x = 0; x < image.width; x++) {
+            size_t pixel = row * image.width + x;
+            if (!mask[pixel]) continue;
+            count++;
+
+            philox_stream rng(view, pixel); // the pixel's rotation of the sample set
+            float shift[sample_dimensions];
+            for (float &s: shift) s = rng.uniform();
+            float u = float(x) / (image.width-1);
+            float v = float(image.height-1 - y) / (image.height-1);
+            float sum = 0;
+            for (int first = 0; first < n; first += ray_packet::max_size) {
+                int size = std::min(n - first, static_cast<int>(ray_packet::max_size));
+                packet.clear();
+                for (int k = first; k < first + size; k++) {
+                    float source_x = 0, source_y = 0;
+                    if (spread) {
+                        spot->offset(hammersley(k, n, 0, shift[0]), hammersley(k, n, 1, shift[1]), source_x, source_y);
+                    }
+                    if (integrate) {
+                        float s = hammersley(k, n, area_dimension, shift[area_dimension]);
+                        float t = hammersley(k, n, area_dimension + 1, shift[area_dimension + 1]);
+                        antialiasing::pixel_point(x, y, image.width, image.height, s, t, u, v);
+                    }
+                    packet.add(cam.get_ray(u, v, source_x, source_y));
+                }
+                packet.finalize();
+
+                for (int i = 0; i < size; i++) recs[i].clear();
+                world.hit_packet(packet, 0, infinity, recs, hits);
+                for (int i = 0; i < size; i++) {
+                    sum += record_intensity(packet.rays[i], hits[i], recs[i], weights);
+                }
+            }
+            image.at(x, y) = sum / n;
+        }
+    });
+    return count;
+}
+
+#endif //RENDERER_H
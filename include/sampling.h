@@ -0,0 +1,35 @@
+#ifndef SAMPLING_H
+#define SAMPLING_H
+
+#include <cmath>
+#include <cstdint>
+
+// Low discrepancy sample sets for supersampling a pixel. Sample k of n is a point of the n point Hammersley set,
+// (k + 1/2) / n in the first dimension and radical inverses of k in bases 2, 3 and 5 in the others, and every
+// pixel shifts the set by its own random offset (Cranley–Patterson rotation) so neighbouring pixels do not
+// repeat the same pattern.
+const int sample_dimensions = 4;
+
+inline float radical_inverse(uint32_t k, uint32_t base) {
+    if (base == 2) {
+        k = (k << 16) | (k >> 16);
+        k = ((k & 0x00FF00FFu) << 8) | ((k & 0xFF00FF00u) >> 8);
+        k = ((k & 0x0F0F0F0Fu) << 4) | ((k & 0xF0F0F0F0u) >> 4);
+        k = ((k & 0x33333333u) << 2) | ((k & 0xCCCCCCCCu) >> 2);
+        k = ((k & 0x55555555u) << 1) | ((k & 0xAAAAAAAAu) >> 1);
+        return std::fmin(k * (1.0f / 4294967296.0f), 0x1.fffffep-1f);
+    }
+    float inverse_base = 1.0f / base, scale = inverse_base, value = 0;
+    for (; k > 0; k /= base, scale *= inverse_base) value += (k % base) * scale;
+    return value;
+}
+
+// Coordinate dimension (0 to 3) of sample k of n, rotated by shift and wrapped into [0, 1)
+inline float hammersley(int k, int n, int dimension, float shift) {
+    static const uint32_t bases[sample_dimensions] = {0, 2, 3, 5};
+    float value = dimension == 0 ? (k + 0.5f) / n : radical_inverse(static_cast<uint32_t>(k), bases[dimension]);
+    value += shift;
+    return value >= 1 ? value - 1 : value;
+}
+
+#endif //SAMPLING_H
@@ -0,0 +1,167 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "camera.h"
+#include "hittable_list.h"
+#include "instance.h"
+#include "json.h"
+#include "mesh.h"
+#include "sphere.h"
+#include "spectrum.h"
+#include "voxel_volume.h"
+
+#include <fstream>
+#include <map>
+
+using nlohmann::json;
+
+// Vector from {"x": .., "y": .., "z": ..} or [x, y, z], fallback when the value is missing
+vec3 json_vec3(const json& j, const string& key, const vec3& fallback) {
+    if (!j.contains(key)) return fallback;
+    const json &v = j[key];
+    if (v.is_array()) return vec3(v[0].get<float>(), v[1].get<float>(), v[2].get<float>());
+    return vec3(v.value("x", 0.0f), v.value("y", 0.0f), v.value("z", 0.0f));
+}
+
+// Builds the world from a scene description instead of hard-coded objects. The description is the config's
+// "scene" entry, either inline or the path of a JSON file (like cfg/object_cfg.json):
+//
+// {"energy": 40,
+//  "objects": [{"type": "mesh", "file": "stl/Soda_Can.stl", "material": "Al", "position": {"x": 0, "y": 0, "z": -44},
+//               "rotation": {"x": 0, "y": 90, "z": 0}, "scale": 1},
+//              {"type": "sphere", "center": {"x": 0, "y": 0, "z": -30}, "radius": 2, "material": "Water", "energy": 60},
+//              {"type": "voxels", "header": "phantom.mhd", "materials": {"1": "Water", "2": "Bone, Cortical (ICRP)"}},
+//              {"type": "voxels", "header": "density.mhd", "material": "Water"}]}
+//
+// Any object may set a "priority": where objects overlap, the highest priority decides the material (a liquid
+// inside its container gets a higher one than the container).
+//
+// Positions are world coordinates [cm], energies are effective energies [keV] and default to the scene's. Mesh
+// objects are scaled, then rotated about x, y and z in turn (degrees), then moved to position. Each
+// (material, energy) pair is built once and shared, and each STL is read and its BVH built once: every mesh
+// object is an instance of the shared geometry. A top level BVH over all objects is built at the end.
+class scene {
+public:
+    // Materials are prepared for the source spectrum when it is not empty
+    explicit scene(const spectrum& source) : source(source) {}
+
+    void load(const json& scene_config);
+
+    shared_ptr<material> get_material(const string& name, float energy);
+
+    // Camera posed by the config's "camera" section: position, look_at and up, looking down -z by default
+    static camera make_camera(const json& config, float viewport_width, float aspect_ratio, float focal_length);
+
+public:
+    hittable_list world;
+
+private:
+    const spectrum& source;
+    std::map<std::pair<string, float>, shared_ptr<material>> materials;
+    std::map<string, shared_ptr<mesh>> meshes; // object space geometry shared by the instances
+
+    shared_ptr<mesh> get_mesh(const string& file, shared_ptr<material> m);
+    static affine_transform object_transform(const json& object);
+};
+
+void scene::load(const json& scene_config) {
+    json description = scene_config;
+    if (scene_config.is_string()) {
+        string path = scene_config.get<string>();
+        std::ifstream file(path);
+        if (!file) {
+            std::cerr << "Error opening scene file " << path << std::endl;
+            exit(1);
+        }
+        try {
+            description = json::parse(file);
+        } catch (json::parse_error& e) {
+            std::cerr << "Failed to parse scene file " << path << ": " << e.what() << std::endl;
+            exit(1);
+        }
+    }
+
+    const json objects = description.value("objects", json::array());
+    float default_energy = description.value("energy", 40.0f);
+    std::cout << "<Scene>\n" << objects.size() << " objects" << std::endl;
+    for (const json &object: objects) {
+        string type = object.value("type", string(""));
+        float energy = object.value("energy", default_energy);
+
+        shared_ptr<hittable> added;
+        if (type == "mesh") {
+            auto m = get_material(object["material"].get<string>(), energy);
+            added = make_shared<instance>(get_mesh(object["file"].get<string>(), m), object_transform(object), m);
+        }
+        else if (type == "sphere") {
+            auto m = get_material(object["material"].get<string>(), energy);
+            added = make_shared<sphere>(json_vec3(object, "center", vec3(0, 0, 0)), object["radius"].get<float>(), m);
+        }
+        else if (type == "voxels") {
+            string header = object["header"].get<string>();
+            vec3 position = json_vec3(object, "position", vec3(0, 0, 0));
+            if (object.contains("material")) {
+                added = make_shared<voxel_volume>(header, get_material(object["material"].get<string>(), energy),
+                                                  position);
+            }
+            else {
+                std::map<int, shared_ptr<material>> labels;
+                for (auto &entry: object["materials"].items()) {
+                    labels[std::stoi(entry.key())] = get_material(entry.value().get<string>(), energy);
+                }
+                added = make_shared<voxel_volume>(header, labels, position);
+            }
+        }
+        else {
+            std::cerr << "Unknown scene object type \"" << type << "\", expected mesh, sphere or voxels" << std::endl;
+            exit(1);
+        }
+        added->priority = object.value("priority", 0);
+        world.add(added);
+    }
+    world.build_bvh();
+    std::cout << materials.size() << " materials, " << meshes.size() << " meshes\n" << std::endl;
+}
+
+shared_ptr<material> scene::get_material(const string& name, float energy) {
+    auto &m = materials[{name, energy}];
+    if (!m) {
+        m = make_shared<material>(name.c_str(), energy);
+        if (!source.empty()) m->use_spectrum(source);
+    }
+    return m;
+}
+
+shared_ptr<mesh> scene::get_mesh(const string& file, shared_ptr<material> m) {
+    auto &object = meshes[file];
+    if (!object) object = make_shared<mesh>(file.c_str(), vec3(0, 0, 0), m);
+    return object;
+}
+
+affine_transform scene::object_transform(const json& object) {
+    vec3 scale(1, 1, 1);
+    if (object.contains("scale") && object["scale"].is_number()) {
+        float s = object["scale"].get<float>();
+        scale = vec3(s, s, s);
+    }
+    else {
+        scale = json_vec3(object, "scale", scale);
+    }
+    vec3 angles = json_vec3(object, "rotation", vec3(0, 0, 0));
+
+    affine_transform t = affine_transform::scaling(scale);
+    for (int a = 0; a < 3; a++) {
+        if (angles[a] != 0) t = affine_transform::rotation(vec3(a == 0, a == 1, a == 2), degrees_to_radians(angles[a])) * t;
+    }
+    return affine_transform::translation(json_vec3(object, "position", vec3(0, 0, 0))) * t;
+}
+
+camera scene::make_camera(const json& config, float viewport_width, float aspect_ratio, float focal_length) {
+    json camera_config = config.value("camera", json::object());
+    vec3 position = json_vec3(camera_config, "position", vec3(0, 0, 0));
+    vec3 look_at = json_vec3(camera_config, "look_at", position - vec3(0, 0, 1));
+    vec3 up = json_vec3(camera_config, "up", vec3(0, 1, 0));
+    return camera(viewport_width, aspect_ratio, focal_length, position, look_at, up);
+}
+
+#endif //SCENE_H
@@ -0,0 +1,71 @@
+#ifndef SMALL_VECTOR_H
+#define SMALL_VECTOR_H
+
+#include <algorithm>
+#include <vector>
+
+// Vector that keeps its first N elements inline, so the common case needs no heap allocation. Once it grows
+// past N the elements move to a heap vector, which keeps its capacity across clear() for reuse.
+template<typename T, int N>
+class small_vector {
+public:
+    small_vector() {}
+    small_vector(const small_vector& other) { *this = other; }
+
+    small_vector& operator=(const small_vector& other) {
+        if (this == &other) return *this;
+        clear();
+        for (const T &value: other) { // copies the used elements only, not the whole inline buffer
+            push_back(value);
+        }
+        return *this;
+    }
+
+    void push_back(const T& value) {
+        if (count < N) {
+            inline_data[count++] = value;
+            return;
+        }
+        if (count == N) overflow.assign(inline_data, inline_data + N); // spill to the heap
+        overflow.push_back(value);
+        count++;
+    }
+
+    void pop_back() {
+        count--;
+        if (count < N) return;
+        overflow.pop_back();
+        if (count == N) { // fits inline again
+            std::copy(overflow.begin(), overflow.end(), inline_data);
+            overflow.clear();
+        }
+    }
+
+    T& back() { return data()[count - 1]; }
+
+    void clear() {
+        count = 0;
+        overflow.clear();
+    }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    T* data() { return count > N ? overflow.data() : inline_data; }
+    const T* data() const { return count > N ? overflow.data() : inline_data; }
+
+    T& operator[](size_t i) { return data()[i]; }
+    const T& operator[](size_t i) const { return data()[i]; }
+
+    T* begin() { return data(); }
+    T* end() { return data() + count; }
+    const T* begin() const { return data(); }
+    const T* end() const { return data() + count; }
+
+private:
+    T inline_data[N];
+    size_t count = 0;
+    std::vector<T> overflow;
+};
+
+#endif //SMALL_VECTOR_H
@@ -0,0 +1,74 @@
+#ifndef SPECTRUM_H
+#define SPECTRUM_H
+
+#include "utility.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+const int max_spectrum_bins = 1024;
+
+// Binned x-ray source spectrum. Read from a text table with one bin per line, "energy [keV], weight", as
+// written by experiments/effEnergy/simulated/export_spectrum.py. Lines starting with # are skipped, and the
+// weights are normalised to sum to one.
+class spectrum {
+public:
+    spectrum() {}
+    spectrum(const string& filename) { load(filename); }
+
+    void load(const string& filename);
+
+    size_t size() const { return energies.size(); }
+    bool empty() const { return energies.empty(); }
+
+    float mean_energy() const; // weighted mean bin energy [keV]
+
+public:
+    std::vector<float> energies; // bin centres [keV]
+    std::vector<float> weights;  // fraction of photons in each bin
+};
+
+void spectrum::load(const string& filename) {
+    std::ifstream file(filename);
+    if (!file) {
+        std::cerr << "Error opening spectrum file " << filename << std::endl;
+        exit(1);
+    }
+
+    energies.clear();
+    weights.clear();
+    string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        std::replace(line.begin(), line.end(), ',', ' ');
+        std::istringstream values(line);
+        float e, w;
+        if (!(values >> e >> w)) continue; // header or malformed line
+        if (w <= 0) continue; // empty bins cost time and add nothing
+        energies.push_back(e);
+        weights.push_back(w);
+    }
+
+    if (energies.empty() || energies.size() > max_spectrum_bins) {
+        std::cerr << "Spectrum file " << filename << " must have between 1 and " << max_spectrum_bins << " bins" << std::endl;
+        exit(1);
+    }
+
+    float total = 0;
+    for (float w: weights) total += w;
+    for (float &w: weights) w /= total;
+
+    std::cout << "<Source Spectrum>\n" << filename << ": " << size() << " bins, mean energy = " << mean_energy()
+              << " keV\n" << std::endl;
+}
+
+float spectrum::mean_energy() const {
+    float mean = 0;
+    for (int i = 0; i < size(); i++) {
+        mean += energies[i] * weights[i];
+    }
+    return mean;
+}
+
+#endif //SPECTRUM_H
@@ -10,6 +10,7 @@ public:
     sphere(vec3 cen, float r, shared_ptr<material> m) : center(cen), radius(r), mat_ptr(m) {};
 
     virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
+    virtual bool bounding_box(aabb& output_box) const override;
 
 public:
     vec3 center;
@@ -28,24 +29,29 @@ bool sphere::hit(const ray &r, float t_min, float t_max, hit_record &rec) const
     auto sqrtd = sqrt(discriminant);
 
     // Find all roots that lie in the acceptable range.
-    float dist;
     bool is_hit = false;
-    auto root0 = (-half_b + sqrtd) / a;  // calculate both possible roots
+    auto root0 = (-half_b + sqrtd) / a;  // calculate both possible roots, root0 is the exit
     auto root1 = (-half_b - sqrtd) / a;
     if (root0 > t_min && t_max > root0) { // check if root0 is in the acceptable range
         rec.t.push_back(root0); // store root0
         rec.p.push_back(r.at(root0)); // store the point of root0
-        dist = 0; // distance travelled through material is zero
         is_hit = true;
     };
     if (root1 > t_min && t_max > root1 && root1 != root0) { // check if root1 is in the acceptable range
         rec.t.push_back(root1); // store root1
         rec.p.push_back(r.at(root1)); // store the point of root1
-        dist = r.diff(root0, root1); // calculate the distance travelled through material
         is_hit = true;
     };
-    rec.trans_prob = mat_ptr->transmission(dist);  // calculate the transmission probability
+
+    // the part of the chord within [t_min, t_max] is inside the sphere
+    float t_in = std::max<float>(root1, t_min), t_out = std::min<float>(root0, t_max);
+    if (is_hit && t_out > t_in) rec.intervals.push_back({mat_ptr.get(), t_in, t_out, priority, 1});
     return is_hit;
 };
 
+bool sphere::bounding_box(aabb &output_box) const {
+    output_box = aabb(center - vec3(radius, radius, radius), center + vec3(radius, radius, radius));
+    return true;
+}
+
 #endif //SPHERE_H
@@ -30,6 +30,8 @@
  * whether an *ASCII* or a *Binary* file is to be read. It identifies matching corner
  * coordinates of triangles with each other, so that the resulting coordinate
  * array does not contain the same coordinate-triple multiple times.
+ * Files are memory-mapped and parsed and welded on several threads (see
+ * `ReadStlFile_BINARY_MAPPED(...)` and `ReadStlFile_ASCII_MAPPED(...)`).
  *
  * The function operates on template container types. Those containers should
  * have similar interfaces as `std::vector` and operate on `float` or `double` types
@@ -128,11 +130,23 @@
 #define __H__STL_READER
 
 #include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <exception>
 #include <fstream>
 #include <sstream>
+#include <string>
+#include <thread>
 #include <vector>
 
+#if __has_include(<charconv>)
+#include <charconv>
+#endif
+
+#include "mapped_file.h"
+
 #ifdef STL_READER_NO_EXCEPTIONS
 #define STL_READER_THROW(msg) return false;
   #define STL_READER_COND_THROW(cond, msg) if(cond) return false;
@@ -222,6 +236,50 @@ namespace stl_reader {
                             TIndexContainer1& trisOut,
                             TIndexContainer2& solidRangesOut);
 
+/// Reads a binary stl file into several arrays, using several threads
+/** Memory-maps the file, decodes the triangle records in parallel chunks straight
+ * into the output containers and identifies matching corner coordinates through a
+ * concurrent hash table instead of sorting all corners. The results are those of
+ * ReadStlFile_BINARY, except that unique coordinates are stored in the order in which
+ * they first appear in the file rather than sorted. They do not depend on the number
+ * of threads. Files which cannot be mapped are read by ReadStlFile_BINARY.
+ *
+ * \param numThreads [in] The number of threads to use, 0 uses one per hardware thread.
+ *
+ * \copydetails ReadStlFile
+ * \sa    ReadStlFile, ReadStlFile_BINARY
+ */
+    template <class TNumberContainer1, class TNumberContainer2,
+            class TIndexContainer1, class TIndexContainer2>
+    bool ReadStlFile_BINARY_MAPPED(const char* filename,
+                                   TNumberContainer1& coordsOut,
+                                   TNumberContainer2& normalsOut,
+                                   TIndexContainer1& trisOut,
+                                   TIndexContainer2& solidRangesOut,
+                                   unsigned int numThreads = 0);
+
+/// Reads an ASCII stl file into several arrays, using several threads
+/** Memory-maps the file and splits it at `facet` lines into chunks, which are parsed
+ * on their own threads with a number parser that does not depend on the locale. The
+ * chunks are merged in order and welded as in ReadStlFile_BINARY_MAPPED. The results
+ * are those of ReadStlFile_ASCII, except that unique coordinates are stored in the
+ * order in which they first appear and vertices outside complete facets are dropped.
+ * Files which cannot be mapped are read by ReadStlFile_ASCII.
+ *
+ * \param numThreads [in] The number of threads to use, 0 uses one per hardware thread.
+ *
+ * \copydetails ReadStlFile
+ * \sa    ReadStlFile, ReadStlFile_ASCII
+ */
+    template <class TNumberContainer1, class TNumberContainer2,
+            class TIndexContainer1, class TIndexContainer2>
+    bool ReadStlFile_ASCII_MAPPED(const char* filename,
+                                  TNumberContainer1& coordsOut,
+                                  TNumberContainer2& normalsOut,
+                                  TIndexContainer1& trisOut,
+                                  TIndexContainer2& solidRangesOut,
+                                  unsigned int numThreads = 0);
+
 /// Determines whether a stl file has ASCII format
 /** The underlying mechanism is simply checks whether the provided file starts
  * with the keyword solid. This should work for many stl files, but may
@@ -506,6 +564,399 @@ namespace stl_reader {
             if(numUniqueTriInds < trisInOut.size())
                 trisInOut.resize (numUniqueTriInds);
         }
+
+        // calls f(chunk, begin, end) for numChunks contiguous ranges covering [0, count),
+        // each chunk but the first on its own thread
+        template <class TFunction>
+        void ParallelChunks (size_t count, size_t numChunks, TFunction f)
+        {
+            std::vector<std::thread> threads;
+            for(size_t i = 1; i < numChunks; ++i)
+                threads.emplace_back(f, i, count * i / numChunks, count * (i + 1) / numChunks);
+            f(size_t(0), size_t(0), count / numChunks);
+            for(size_t i = 0; i < threads.size(); ++i)
+                threads[i].join();
+        }
+
+        // number of chunks to split count items into, so that no chunk has less than
+        // minChunkSize items and no more than numThreads (0: hardware threads) are used
+        inline size_t NumChunks (size_t count, unsigned int numThreads, size_t minChunkSize)
+        {
+            if(numThreads == 0)
+                numThreads = std::max(1u, std::thread::hardware_concurrency());
+            return std::max<size_t>(1, std::min<size_t>(numThreads, count / minChunkSize));
+        }
+
+        // Open addressing hash table from coordinate triples to the first corner
+        // (in file order) carrying them, which may be filled from several threads.
+        // Corners are numbered 3 * triangle + corner, coordinates are read through
+        // the corner function, which returns a pointer to 3 TCoord (possibly unaligned).
+        // Corners are equal if their coordinates compare equal, as in RemoveDoubles.
+        template <class TCoord, class TCornerFunction>
+        class CornerTable {
+        public:
+            static const uint32_t empty = 0xFFFFFFFFu;
+
+            CornerTable (size_t numCorners, TCornerFunction cornerFunction) :
+                corner(cornerFunction)
+            {
+                //  at most two thirds full, even if no corners are shared
+                size_t size = 16;
+                while(size < numCorners + numCorners / 2)
+                    size *= 2;
+                slots = std::vector<std::atomic<uint32_t> > (size);
+                mask = size - 1;
+                for(size_t i = 0; i < size; ++i)
+                    slots[i].store(empty, std::memory_order_relaxed);
+            }
+
+            // first slot probed for corner c, prefetched as the table is much larger than the caches
+            size_t home (uint32_t c) const
+            {
+                TCoord coords[3];
+                load(c, coords);
+                size_t slot = hash(coords) & mask;
+                __builtin_prefetch(&slots[slot], 1);
+                return slot;
+            }
+
+            // adds corner c, whose first slot is home(c), and returns the slot of its coordinates
+            size_t insert (uint32_t c, size_t slot)
+            {
+                TCoord coords[3];
+                load(c, coords);
+                while(true){
+                    uint32_t cur = slots[slot].load(std::memory_order_relaxed);
+                    if(cur == empty && slots[slot].compare_exchange_strong(cur, c, std::memory_order_relaxed))
+                        return slot;
+
+                    //  cur now holds the occupying corner, keep the smallest one with these coordinates
+                    if(equal(coords, cur)){
+                        while(c < cur && !slots[slot].compare_exchange_weak(cur, c, std::memory_order_relaxed)){}
+                        return slot;
+                    }
+                    slot = (slot + 1) & mask;
+                }
+            }
+
+            uint32_t get (size_t slot) const    {return slots[slot].load(std::memory_order_relaxed);}
+            void release ()                     {std::vector<std::atomic<uint32_t> > ().swap(slots);}
+
+        private:
+            TCornerFunction corner;
+            std::vector<std::atomic<uint32_t> > slots;
+            size_t mask;
+
+            void load (uint32_t c, TCoord coords[3]) const
+            {
+                memcpy(coords, corner(c), 3 * sizeof(TCoord));
+            }
+
+            bool equal (const TCoord coords[3], uint32_t other) const
+            {
+                TCoord o[3];
+                load(other, o);
+                return (coords[0] == o[0]) && (coords[1] == o[1]) && (coords[2] == o[2]);
+            }
+
+            static size_t hash (const TCoord coords[3])
+            {
+                //  hashed as doubles, where -0 and 0 (which compare equal) get the same bits
+                uint64_t h = 0;
+                for(int i = 0; i < 3; ++i){
+                    double c = static_cast<double> (coords[i]) + 0.0;
+                    uint64_t bits;
+                    memcpy(&bits, &c, sizeof(double));
+                    h = (h ^ bits) * 0x9E3779B97F4A7C15ull;
+                    h ^= h >> 32;
+                }
+                h *= 0x94D049BB133111EBull;
+                h ^= h >> 29;
+                return static_cast<size_t>(h);
+            }
+        };
+
+        // Welds the corners of numTris triangles, whose coordinates are returned by
+        // cornerFunction(3 * triangle + corner) as 3 TCoord, into unique coordinates and
+        // triangle corner indices, in the same way as RemoveDoubles: unique coordinates are
+        // numbered in order of first appearance and degenerated triangles are removed.
+        template <class TCoord, class TNumberContainer, class TIndexContainer, class TCornerFunction>
+        void WeldCorners (TNumberContainer& uniqueCoordsOut,
+                          TIndexContainer& trisOut,
+                          size_t numTris,
+                          TCornerFunction cornerFunction,
+                          unsigned int numThreads)
+        {
+            typedef typename TNumberContainer::value_type number_t;
+            typedef typename TIndexContainer::value_type  index_t;
+
+            const size_t numCorners = 3 * numTris;
+            CornerTable<TCoord, TCornerFunction> table (numCorners, cornerFunction);
+            std::vector<uint32_t> slotOf (numCorners);
+            const size_t numChunks = NumChunks (numCorners, numThreads, 1 << 15);
+
+            //  the home slots are looked up a few corners ahead, so that their cache misses overlap
+            const size_t ahead = 16;
+            ParallelChunks (numCorners, numChunks, [&](size_t, size_t begin, size_t end){
+                for(size_t c = begin; c < std::min(begin + ahead, end); ++c)
+                    slotOf[c] = static_cast<uint32_t> (table.home(static_cast<uint32_t> (c)));
+                for(size_t c = begin; c < end; ++c){
+                    if(c + ahead < end)
+                        slotOf[c + ahead] = static_cast<uint32_t> (table.home(static_cast<uint32_t> (c + ahead)));
+                    slotOf[c] = static_cast<uint32_t> (table.insert(static_cast<uint32_t> (c), slotOf[c]));
+                }
+            });
+
+            //  each corner's slot now holds the first corner with its coordinates. Keep that instead
+            //  of the slot and count the first corners per chunk, so each chunk knows where its
+            //  vertices start.
+            std::vector<size_t> chunkFirst (numChunks + 1, 0);
+            ParallelChunks (numCorners, numChunks, [&](size_t chunk, size_t begin, size_t end){
+                size_t count = 0;
+                for(size_t c = begin; c < end; ++c){
+                    slotOf[c] = table.get(slotOf[c]);
+                    count += (slotOf[c] == c);
+                }
+                chunkFirst[chunk + 1] = count;
+            });
+            for(size_t i = 0; i < numChunks; ++i)
+                chunkFirst[i + 1] += chunkFirst[i];
+            std::vector<uint32_t>& firstOf = slotOf;
+            table.release();
+
+            //  copy the unique coordinates, first corners then hold their vertex index (marked by the high bit)
+            const uint32_t isVertex = 0x80000000u;
+            uniqueCoordsOut.resize (chunkFirst[numChunks] * 3);
+            ParallelChunks (numCorners, numChunks, [&](size_t chunk, size_t begin, size_t end){
+                size_t vrt = chunkFirst[chunk];
+                for(size_t c = begin; c < end; ++c){
+                    if(firstOf[c] != c)
+                        continue;
+                    TCoord coords[3];
+                    memcpy(coords, cornerFunction(c), 3 * sizeof(TCoord));
+                    for(size_t i = 0; i < 3; ++i)
+                        uniqueCoordsOut[vrt * 3 + i] = static_cast<number_t> (coords[i]);
+                    firstOf[c] = static_cast<uint32_t> (vrt++) | isVertex;
+                }
+            });
+
+            //  re-index triangles, then drop those which do not refer to three different indices
+            trisOut.resize (numCorners);
+            ParallelChunks (numCorners, numChunks, [&](size_t, size_t begin, size_t end){
+                for(size_t c = begin; c < end; ++c){
+                    uint32_t f = firstOf[c];
+                    trisOut[c] = static_cast<index_t> ((f & isVertex ? f : firstOf[f]) & ~isVertex);
+                }
+            });
+
+            size_t numUniqueTriInds = 0;
+            for(size_t i = 0; i < numCorners; i += 3){
+                index_t ni[3] = {trisOut[i], trisOut[i + 1], trisOut[i + 2]};
+                if((ni[0] != ni[1]) && (ni[0] != ni[2]) && (ni[1] != ni[2])){
+                    if(numUniqueTriInds != i){
+                        for(int j = 0; j < 3; ++j)
+                            trisOut[numUniqueTriInds + j] = ni[j];
+                    }
+                    numUniqueTriInds += 3;
+                }
+            }
+
+            if(numUniqueTriInds < trisOut.size())
+                trisOut.resize (numUniqueTriInds);
+        }
+
+        // Parses the number at the start of [first, last) as atof does in the "C" locale:
+        // the longest prefix which forms a number, or 0 if there is none. Returns the end
+        // of that prefix.
+        inline const char* ParseNumber (const char* first, const char* last, double& value)
+        {
+            value = 0;
+            if(first != last && *first == '+')
+                ++first;
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+            return std::from_chars(first, last, value).ptr;
+#else
+            //  decimal digits into an integer mantissa, exact in a double for up to 15 digits
+            //  and powers of ten up to 22, as in typical stl files
+            const char* p = first;
+            bool negative = (p != last && *p == '-');
+            if(negative)
+                ++p;
+            uint64_t mantissa = 0;
+            int exponent = 0, digits = 0;
+            bool point = false, any = false;
+            for(; p != last; ++p){
+                if(*p == '.' && !point)
+                    point = true;
+                else if(*p >= '0' && *p <= '9'){
+                    any = true;
+                    if(digits < 19){
+                        mantissa = mantissa * 10 + (*p - '0');
+                        if(mantissa != 0)
+                            ++digits;
+                        exponent -= point;
+                    }
+                    else
+                        exponent += !point;
+                }
+                else
+                    break;
+            }
+            if(!any)
+                return first;
+            if(p != last && (*p == 'e' || *p == 'E')){
+                const char* e = p + 1;
+                bool negativeExponent = (e != last && *e == '-');
+                if(e != last && (*e == '-' || *e == '+'))
+                    ++e;
+                int power = 0;
+                bool anyExponent = false;
+                for(; e != last && *e >= '0' && *e <= '9'; ++e){
+                    anyExponent = true;
+                    power = std::min(power * 10 + (*e - '0'), 100000);
+                }
+                if(anyExponent){
+                    exponent += negativeExponent ? -power : power;
+                    p = e;
+                }
+            }
+            static const double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+            value = static_cast<double> (mantissa);
+            if(mantissa < (uint64_t(1) << 53) && exponent >= -22 && exponent <= 22)
+                value = exponent < 0 ? value / powers[-exponent] : value * powers[exponent];
+            else
+                value *= std::pow(10.0, exponent);
+            if(negative)
+                value = -value;
+            return p;
+#endif
+        }
+
+        inline bool IsSpace (char c)
+        {
+            return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+        }
+
+        // start of the first line at or after p whose first token is "facet", or end
+        inline const char* FindFacetLine (const char* data, const char* p, const char* end)
+        {
+            while(p < end){
+                if(p != data && p[-1] != '\n'){
+                    p = static_cast<const char*> (memchr(p, '\n', end - p));
+                    if(!p)
+                        return end;
+                    ++p;
+                    continue;
+                }
+                const char* tok = p;
+                while(tok < end && IsSpace(*tok))
+                    ++tok;
+                if(end - tok >= 5 && memcmp(tok, "facet", 5) == 0 && (end - tok == 5 || IsSpace(tok[5]) || tok[5] == '\n'))
+                    return p;
+                ++p;
+            }
+            return end;
+        }
+
+        // What a thread reads from its chunk of an ASCII stl file, merged in chunk order
+        template <typename number_t>
+        struct AsciiChunk {
+            std::vector<number_t> corners;  // 9 coordinates per complete facet
+            std::vector<number_t> normals;  // 3 per facet line
+            std::vector<size_t>   solids;   // complete facets in the chunk before each solid line
+            std::string error;              // the first error, at the line starting at errorOffset
+            size_t errorOffset = 0;
+        };
+
+        // parses the lines in [begin, end) as ReadStlFile_ASCII does. Only the keyword of a
+        // line is split off, numbers are parsed where they are.
+        template <typename number_t>
+        void ParseAsciiChunk (const char* begin, const char* end, AsciiChunk<number_t>& out)
+        {
+            number_t face[9];
+            size_t numFaceVrts = 0;
+
+            for(const char* line = begin; line < end;){
+                const char* lineEnd = static_cast<const char*> (memchr(line, '\n', end - line));
+                if(!lineEnd)
+                    lineEnd = end;
+
+                //  the next token of the line, empty at its end
+                const char* p = line;
+                auto token = [&](size_t& length){
+                    while(p < lineEnd && IsSpace(*p))
+                        ++p;
+                    const char* first = p;
+                    while(p < lineEnd && !IsSpace(*p))
+                        ++p;
+                    length = p - first;
+                    return first;
+                };
+                //  the next n tokens as numbers, false if the line has fewer
+                auto numbers = [&](int n, number_t* values){
+                    for(int i = 0; i < n; ++i){
+                        while(p < lineEnd && IsSpace(*p))
+                            ++p;
+                        if(p == lineEnd)
+                            return false;
+                        double value;
+                        p = ParseNumber(p, lineEnd, value);
+                        values[i] = static_cast<number_t> (value);
+                        while(p < lineEnd && !IsSpace(*p)) // rest of the token, as atof ignores it
+                            ++p;
+                    }
+                    return true;
+                };
+                auto fail = [&](const char* message){
+                    out.error = message;
+                    out.errorOffset = line - begin;
+                };
+
+                size_t length;
+                const char* keyword = token(length);
+                auto is = [&](const char* tok, size_t len, const char* expected){
+                    return len == strlen(expected) && memcmp(tok, expected, len) == 0;
+                };
+
+                if(is(keyword, length, "vertex")){
+                    number_t c[3];
+                    if(!numbers(3, c))
+                        return fail("vertex not specified correctly");
+                    if(numFaceVrts < 3){
+                        for(int i = 0; i < 3; ++i)
+                            face[numFaceVrts * 3 + i] = c[i];
+                    }
+                    ++numFaceVrts;
+                }
+                else if(is(keyword, length, "facet")){
+                    size_t normalLength;
+                    const char* normal = token(normalLength);
+                    number_t n[3];
+                    if(normalLength == 0 || !numbers(3, n))
+                        return fail("triangle not specified correctly");
+                    if(!is(normal, normalLength, "normal"))
+                        return fail("Missing normal specifier");
+                    out.normals.insert(out.normals.end(), n, n + 3);
+                    numFaceVrts = 0;
+                }
+                else if(is(keyword, length, "outer")){
+                    size_t loopLength;
+                    const char* loop = token(loopLength);
+                    if(!is(loop, loopLength, "loop"))
+                        return fail("expecting outer loop");
+                }
+                else if(is(keyword, length, "endfacet")){
+                    if(numFaceVrts != 3)
+                        return fail("bad number of vertices specified for face");
+                    out.corners.insert(out.corners.end(), face, face + 9);
+                }
+                else if(is(keyword, length, "solid")){
+                    out.solids.push_back(out.corners.size() / 9);
+                }
+                line = lineEnd + 1;
+            }
+        }
     }// end of namespace stl_reader_impl
 
 
@@ -518,9 +969,9 @@ namespace stl_reader {
                      TIndexContainer2& solidRangesOut)
     {
         if(StlFileHasASCIIFormat(filename))
-            return ReadStlFile_ASCII(filename, coordsOut, normalsOut, trisOut, solidRangesOut);
+            return ReadStlFile_ASCII_MAPPED(filename, coordsOut, normalsOut, trisOut, solidRangesOut);
         else
-            return ReadStlFile_BINARY(filename, coordsOut, normalsOut, trisOut, solidRangesOut);
+            return ReadStlFile_BINARY_MAPPED(filename, coordsOut, normalsOut, trisOut, solidRangesOut);
     }
 
 
@@ -700,6 +1151,143 @@ namespace stl_reader {
     }
 
 
+    template <class TNumberContainer1, class TNumberContainer2,
+            class TIndexContainer1, class TIndexContainer2>
+    bool ReadStlFile_BINARY_MAPPED(const char* filename,
+                                   TNumberContainer1& coordsOut,
+                                   TNumberContainer2& normalsOut,
+                                   TIndexContainer1& trisOut,
+                                   TIndexContainer2& solidRangesOut,
+                                   unsigned int numThreads)
+    {
+        using namespace std;
+        using namespace stl_reader_impl;
+
+        typedef typename TNumberContainer2::value_type  normal_t;
+        typedef typename TIndexContainer1::value_type index_t;
+
+        mapped_file file;
+        if(!file.open(filename))
+            return ReadStlFile_BINARY(filename, coordsOut, normalsOut, trisOut, solidRangesOut);
+
+        coordsOut.clear();
+        normalsOut.clear();
+        trisOut.clear();
+        solidRangesOut.clear();
+
+        //  80 byte header, triangle count, then 50 byte records: normal, 3 corners, 2 bytes of attributes
+        const size_t headerSize = 84, recordSize = 50;
+        STL_READER_COND_THROW(file.size() < headerSize,
+                              "Couldnt determine number of triangles in binary stl file " << filename);
+
+        uint32_t numTris = 0;
+        memcpy(&numTris, file.data() + 80, 4);
+        STL_READER_COND_THROW(file.size() < headerSize + size_t(numTris) * recordSize,
+                              "Error while parsing trianlge in binary stl file " << filename);
+        STL_READER_COND_THROW(numTris > 0x3FFFFFFFu / 3, // corner and slot indices need 31 bits
+                              "Too many triangles in binary stl file " << filename);
+
+        const char* records = file.data() + headerSize;
+        normalsOut.resize (size_t(numTris) * 3);
+        ParallelChunks (numTris, NumChunks (numTris, numThreads, 1 << 14), [&](size_t, size_t begin, size_t end){
+            for(size_t tri = begin; tri < end; ++tri){
+                float n[3];
+                memcpy(n, records + tri * recordSize, 3 * sizeof(float));
+                for(size_t i = 0; i < 3; ++i)
+                    normalsOut[tri * 3 + i] = static_cast<normal_t> (n[i]);
+            }
+        });
+
+        //  corners are welded where they are in the mapping, nothing else is copied
+        WeldCorners<float> (coordsOut, trisOut, numTris, [records](size_t c){
+            return records + (c / 3) * recordSize + 12 + (c % 3) * 12;
+        }, numThreads);
+
+        solidRangesOut.push_back(0);
+        solidRangesOut.push_back(static_cast<index_t> (numTris));
+
+        return true;
+    }
+
+
+    template <class TNumberContainer1, class TNumberContainer2,
+            class TIndexContainer1, class TIndexContainer2>
+    bool ReadStlFile_ASCII_MAPPED(const char* filename,
+                                  TNumberContainer1& coordsOut,
+                                  TNumberContainer2& normalsOut,
+                                  TIndexContainer1& trisOut,
+                                  TIndexContainer2& solidRangesOut,
+                                  unsigned int numThreads)
+    {
+        using namespace std;
+        using namespace stl_reader_impl;
+
+        typedef typename TNumberContainer1::value_type  number_t;
+        typedef typename TIndexContainer1::value_type index_t;
+
+        mapped_file file;
+        if(!file.open(filename))
+            return ReadStlFile_ASCII(filename, coordsOut, normalsOut, trisOut, solidRangesOut);
+
+        coordsOut.clear();
+        normalsOut.clear();
+        trisOut.clear();
+        solidRangesOut.clear();
+
+        //  chunks start at facet lines, so that every facet is parsed by one thread
+        const char* data = file.data();
+        const char* end = data + file.size();
+        const size_t numChunks = NumChunks (file.size(), numThreads, 1 << 20);
+        vector<const char*> bounds (numChunks + 1, end);
+        bounds[0] = data;
+        for(size_t i = 1; i < numChunks; ++i)
+            bounds[i] = FindFacetLine (data, max(bounds[i - 1], data + file.size() * i / numChunks), end);
+
+        vector<AsciiChunk<number_t> > chunks (numChunks);
+        ParallelChunks (numChunks, numChunks, [&](size_t chunk, size_t, size_t){
+            ParseAsciiChunk (bounds[chunk], bounds[chunk + 1], chunks[chunk]);
+        });
+
+        for(size_t i = 0; i < numChunks; ++i){
+            if(!chunks[i].error.empty()){
+                const char* line = bounds[i] + chunks[i].errorOffset;
+                size_t lineCount = 1 + count(data, line, '\n');
+                STL_READER_THROW("ERROR while reading from " << filename << ": " << chunks[i].error
+                                 << " in line " << lineCount);
+            }
+        }
+
+        //  merge the chunks in order
+        vector<size_t> firstTri (numChunks + 1, 0), firstNormal (numChunks + 1, 0);
+        for(size_t i = 0; i < numChunks; ++i){
+            firstTri[i + 1] = firstTri[i] + chunks[i].corners.size() / 9;
+            firstNormal[i + 1] = firstNormal[i] + chunks[i].normals.size();
+            for(size_t s : chunks[i].solids)
+                solidRangesOut.push_back(static_cast<index_t> (firstTri[i] + s));
+        }
+        const size_t numTris = firstTri[numChunks];
+        solidRangesOut.push_back(static_cast<index_t> (numTris));
+        STL_READER_COND_THROW(numTris > 0x3FFFFFFFu / 3, "Too many triangles in stl file " << filename);
+
+        vector<number_t> corners (numTris * 9);
+        normalsOut.resize (firstNormal[numChunks]);
+        ParallelChunks (numChunks, numChunks, [&](size_t chunk, size_t, size_t){
+            AsciiChunk<number_t>& c = chunks[chunk];
+            copy(c.corners.begin(), c.corners.end(), corners.begin() + firstTri[chunk] * 9);
+            for(size_t i = 0; i < c.normals.size(); ++i)
+                normalsOut[firstNormal[chunk] + i] = c.normals[i];
+            vector<number_t> ().swap(c.corners);
+            vector<number_t> ().swap(c.normals);
+        });
+
+        WeldCorners<number_t> (coordsOut, trisOut, numTris, [&corners](size_t c){
+            return &corners[3 * c];
+        }, numThreads);
+
+        return true;
+    }
+
+
     inline bool StlFileHasASCIIFormat(const char* filename)
     {
         using namespace std;
@@ -0,0 +1,110 @@
+#ifndef STL_STREAM_H
+#define STL_STREAM_H
+
+#include "mapped_file.h"
+#include "stl_reader.h"
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Triangles of a binary or ASCII STL file in chunks of at most chunk_triangles, for building a mesh without the
+// whole file, a welded copy of it and the mesh in memory at the same time. The file is mapped and its pages are
+// released as soon as a chunk is read, so the resident size stays near one chunk. ASCII chunks are parsed on
+// several threads like ReadStlFile_ASCII_MAPPED, split at facet lines. Normals and solids are skipped, corners
+// are returned as read, without welding. Errors throw std::runtime_error with the messages of stl_reader.
+class stl_stream {
+public:
+    explicit stl_stream(const std::string& filename, size_t chunk_triangles = 1 << 16, unsigned int threads = 0);
+
+    // Number of triangles in a binary file, an upper estimate from the file size for ASCII
+    size_t size_hint() const { return hint; }
+
+    // Replaces corners with the next chunk, 9 floats (v0, v1, v2) per triangle, false once the file is done
+    bool next(std::vector<float>& corners);
+
+private:
+    static const size_t header_size = 84, record_size = 50;
+    static const size_t ascii_facet_size = 256;    // typical bytes per ASCII facet, sizes the parse windows
+    static const size_t ascii_min_facet_size = 80; // shorter than any facet written with 1 digit numbers
+
+    std::string filename;
+    mapped_file file;
+    bool ascii = false;
+    size_t chunk_triangles;
+    unsigned int threads;
+    size_t hint = 0;
+    size_t num_triangles = 0; // binary only
+    size_t position = 0;      // next triangle (binary) or byte (ASCII)
+};
+
+stl_stream::stl_stream(const std::string& filename, size_t chunk_triangles, unsigned int threads) :
+        filename(filename),
+        chunk_triangles(std::max<size_t>(1, chunk_triangles)),
+        threads(threads) {
+    if (!file.open(filename)) throw std::runtime_error("Couldnt open file " + filename);
+    ascii = stl_reader::StlFileHasASCIIFormat(filename.c_str());
+    if (ascii) {
+        hint = file.size() / ascii_min_facet_size;
+        return;
+    }
+
+    if (file.size() < header_size) {
+        throw std::runtime_error("Couldnt determine number of triangles in binary stl file " + filename);
+    }
+    uint32_t count;
+    std::memcpy(&count, file.data() + 80, 4);
+    if (file.size() < header_size + size_t(count) * record_size) {
+        throw std::runtime_error("Error while parsing trianlge in binary stl file " + filename);
+    }
+    num_triangles = hint = count;
+}
+
+bool stl_stream::next(std::vector<float>& corners) {
+    using namespace stl_reader::stl_reader_impl;
+    corners.clear();
+
+    if (!ascii) {
+        if (position >= num_triangles) return false;
+        size_t count = std::min(chunk_triangles, num_triangles - position);
+        const char *records = file.data() + header_size + position * record_size;
+        corners.resize(9 * count);
+        for (size_t i = 0; i < count; i++) {
+            std::memcpy(&corners[9 * i], records + i * record_size + 12, 9 * sizeof(float));
+        }
+        file.release(header_size + position * record_size, count * record_size);
+        position += count;
+        return true;
+    }
+
+    // a window of about chunk_triangles facets, one part per thread, every part starting at a facet line
+    const char *data = file.data(), *end = data + file.size();
+    if (position >= file.size()) return false;
+    size_t window = chunk_triangles * ascii_facet_size;
+    size_t num_parts = NumChunks(std::min(window, file.size() - position), threads, 1 << 20);
+    std::vector<const char*> bounds(num_parts + 1);
+    bounds[0] = data + position;
+    for (size_t i = 1; i <= num_parts; i++) {
+        const char *target = data + std::min(file.size(), position + window * i / num_parts);
+        bounds[i] = i == num_parts && target == end ? end : FindFacetLine(data, std::max(bounds[i - 1], target), end);
+    }
+
+    std::vector<AsciiChunk<float>> parts(num_parts);
+    ParallelChunks(num_parts, num_parts, [&](size_t part, size_t, size_t) {
+        ParseAsciiChunk(bounds[part], bounds[part + 1], parts[part]);
+    });
+    for (size_t i = 0; i < num_parts; i++) {
+        if (!parts[i].error.empty()) {
+            const char *line = bounds[i] + parts[i].errorOffset;
+            throw std::runtime_error("ERROR while reading from " + filename + ": " + parts[i].error + " in line " +
+                                     std::to_string(1 + std::count(data, line, '\n')));
+        }
+        corners.insert(corners.end(), parts[i].corners.begin(), parts[i].corners.end());
+    }
+
+    file.release(position, bounds[num_parts] - bounds[0]);
+    position = bounds[num_parts] - data;
+    return true;
+}
+
+#endif //STL_STREAM_H
@@ -0,0 +1,109 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include "camera.h"
+#include "image_writer.h"
+#include "json.h"
+#include "renderer.h"
+
+#include <cstdio>
+
+using nlohmann::json;
+
+// Projection sweep (CT acquisition): the source and detector turn about an axis through the isocenter and
+// one projection is rendered per gantry angle, all from the same loaded scene.
+//
+// "sweep": {"views": 360, "start_angle": 0, "end_angle": 360, "axis": "y", "isocenter": {"x": 0, "y": 0, "z": -20},
+//           "stack": true}
+// An explicit "angles" list (degrees) replaces views/start_angle/end_angle for arbitrary C-arm trajectories.
+// Without an isocenter the sweep turns about the centre of the world's bounding box.
+class projection_sweep {
+public:
+    projection_sweep(const json& sweep_config);
+
+    size_t views() const { return angles.size(); }
+
+    // Renders every view, batches of views are rendered together so all threads stay busy
+    void run(renderer& renderer, const camera& cam, const hittable& world, int width, int height,
+             const string& basename, const std::vector<string>& formats);
+
+public:
+    std::vector<float> angles; // degrees
+    vec3 axis;
+    vec3 isocenter;
+    bool has_isocenter = false;
+    bool stack = true; // one (views, height, width) float32 .npy instead of one image per view
+};
+
+projection_sweep::projection_sweep(const json& sweep_config) {
+    if (sweep_config.contains("angles")) {
+        angles = sweep_config["angles"].get<std::vector<float>>();
+    }
+    else {
+        int views = sweep_config.value("views", 360);
+        float start = sweep_config.value("start_angle", 0.0f);
+        float end = sweep_config.value("end_angle", 360.0f);
+        for (int i = 0; i < views; i++) {
+            angles.push_back(start + (end - start) * i / views);
+        }
+    }
+
+    json axis_config = sweep_config.value("axis", json("y"));
+    if (axis_config.is_string()) {
+        string name = axis_config.get<string>();
+        axis = name == "x" ? vec3(1, 0, 0) : name == "z" ? vec3(0, 0, 1) : vec3(0, 1, 0);
+    }
+    else {
+        axis = vec3(axis_config["x"].get<float>(), axis_config["y"].get<float>(), axis_config["z"].get<float>());
+    }
+
+    if (sweep_config.contains("isocenter")) {
+        const json &c = sweep_config["isocenter"];
+        isocenter = vec3(c["x"].get<float>(), c["y"].get<float>(), c["z"].get<float>());
+        has_isocenter = true;
+    }
+    stack = sweep_config.value("stack", true);
+}
+
+void projection_sweep::run(renderer& renderer, const camera& cam, const hittable& world, int width, int height,
+                           const string& basename, const std::vector<string>& formats) {
+    vec3 center = isocenter;
+    aabb world_box;
+    if (!has_isocenter && world.bounding_box(world_box)) center = world_box.centroid();
+
+    cout << "<Projection Sweep>" << endl;
+    cout << views() << " views about axis (" << axis << ") through (" << center << ")\n" << endl;
+
+    npy_stack_writer stack_writer;
+    if (stack && !stack_writer.open(basename, views(), width, height)) return;
+
+    size_t batch = std::max(renderer.threads(), 1);
+    for (size_t first = 0; first < views(); first += batch) {
+        size_t count = std::min(batch, views() - first);
+        std::vector<camera> cams;
+        std::vector<framebuffer> images;
+        for (size_t i = first; i < first + count; i++) {
+            cams.push_back(cam.rotated(axis, degrees_to_radians(angles[i]), center));
+            images.emplace_back(width, height);
+        }
+
+        renderer.render_views(cams, world, images, first);
+
+        for (size_t i = 0; i < count; i++) {
+            if (stack) {
+                stack_writer.append(images[i]);
+                continue;
+            }
+            char suffix[16];
+            std::snprintf(suffix, sizeof(suffix), "_%04zu", first + i);
+            for (const string &format: formats) {
+                image_writer::write(images[i], basename + suffix, format);
+            }
+        }
+        std::cerr << "\rViews remaining: " << views() - first - count << ' ' << std::flush;
+    }
+    std::cerr << "\n";
+    if (stack) stack_writer.close();
+}
+
+#endif //SWEEP_H
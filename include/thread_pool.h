@@ -0,0 +1,147 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads running indexed jobs with work stealing. The calling thread takes part in every
+// job as thread 0, so a pool of n threads spawns n - 1 workers.
+class thread_pool {
+public:
+    explicit thread_pool(int threads = 0); // 0 uses every hardware thread
+    ~thread_pool();
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    int size() const { return num_threads; }
+
+    // Runs task(index, thread_id) for every index in [0, count) and returns once all of them are done.
+    // Each thread starts with a contiguous block of indices in its own queue, and steals from the back of
+    // another thread's queue when its own runs dry. Must not be called from inside a task.
+    void parallel_for(size_t count, const std::function<void(size_t, int)>& task);
+
+private:
+    struct task_queue {
+        std::mutex lock;
+        std::deque<size_t> indices;
+    };
+
+    int num_threads;
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<task_queue>> queues;
+
+    const std::function<void(size_t, int)>* current_task = nullptr;
+    std::mutex state_lock;
+    std::condition_variable start_cv;
+    std::condition_variable done_cv;
+    size_t generation = 0; // incremented for every job so sleeping workers know there is new work
+    int running = 0;       // workers that have not yet finished the current job
+    bool stopping = false;
+
+    void worker_loop(int thread_id);
+    void run_tasks(int thread_id);
+    bool pop(int thread_id, size_t& index);
+    bool steal(int thread_id, size_t& index);
+};
+
+thread_pool::thread_pool(int threads) {
+    num_threads = threads > 0 ? threads : static_cast<int>(std::thread::hardware_concurrency());
+    if (num_threads < 1) num_threads = 1;
+
+    for (int i = 0; i < num_threads; i++) {
+        queues.push_back(std::make_unique<task_queue>());
+    }
+    for (int i = 1; i < num_threads; i++) {
+        workers.emplace_back(&thread_pool::worker_loop, this, i);
+    }
+}
+
+thread_pool::~thread_pool() {
+    {
+        std::lock_guard<std::mutex> guard(state_lock);
+        stopping = true;
+    }
+    start_cv.notify_all();
+    for (auto &worker: workers) {
+        worker.join();
+    }
+}
+
+void thread_pool::parallel_for(size_t count, const std::function<void(size_t, int)>& task) {
+    if (count == 0) return;
+
+    {
+        std::lock_guard<std::mutex> guard(state_lock);
+        for (int t = 0; t < num_threads; t++) { // deal out contiguous blocks so neighbouring indices stay together
+            size_t begin = count * t / num_threads;
+            size_t end = count * (t + 1) / num_threads;
+            std::lock_guard<std::mutex> queue_guard(queues[t]->lock);
+            for (size_t i = begin; i < end; i++) {
+                queues[t]->indices.push_back(i);
+            }
+        }
+        current_task = &task;
+        running = num_threads - 1;
+        generation++;
+    }
+    start_cv.notify_all();
+
+    run_tasks(0);
+
+    std::unique_lock<std::mutex> guard(state_lock);
+    done_cv.wait(guard, [this] { return running == 0; });
+    current_task = nullptr;
+}
+
+void thread_pool::worker_loop(int thread_id) {
+    size_t seen_generation = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> guard(state_lock);
+            start_cv.wait(guard, [&] { return stopping || generation != seen_generation; });
+            if (stopping) return;
+            seen_generation = generation;
+        }
+
+        run_tasks(thread_id);
+
+        std::lock_guard<std::mutex> guard(state_lock);
+        if (--running == 0) done_cv.notify_one();
+    }
+}
+
+void thread_pool::run_tasks(int thread_id) {
+    size_t index;
+    while (pop(thread_id, index) || steal(thread_id, index)) {
+        (*current_task)(index, thread_id);
+    }
+}
+
+bool thread_pool::pop(int thread_id, size_t& index) {
+    task_queue &queue = *queues[thread_id];
+    std::lock_guard<std::mutex> guard(queue.lock);
+    if (queue.indices.empty()) return false;
+    index = queue.indices.front();
+    queue.indices.pop_front();
+    return true;
+}
+
+bool thread_pool::steal(int thread_id, size_t& index) {
+    for (int offset = 1; offset < num_threads; offset++) {
+        task_queue &victim = *queues[(thread_id + offset) % num_threads];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (victim.indices.empty()) continue;
+        index = victim.indices.back(); // take from the far end, away from where the owner is working
+        victim.indices.pop_back();
+        return true;
+    }
+    return false;
+}
+
+#endif //THREAD_POOL_H
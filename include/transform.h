@@ -0,0 +1,101 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "aabb.h"
+#include "vec3.h"
+
+// Affine map p -> m p + offset, used to place shared object space geometry in the world
+class affine_transform {
+public:
+    affine_transform() : m{{1, 0, 0}, {0, 1, 0}, {0, 0, 1}}, offset(0, 0, 0) {}
+
+    static affine_transform translation(const vec3& t) {
+        affine_transform a;
+        a.offset = t;
+        return a;
+    }
+
+    static affine_transform scaling(const vec3& s) {
+        affine_transform a;
+        for (int i = 0; i < 3; i++) a.m[i][i] = s[i];
+        return a;
+    }
+
+    // angle radians about axis, same sense as rotate()
+    static affine_transform rotation(const vec3& axis, float angle) {
+        affine_transform a;
+        vec3 u = unit_vector(axis);
+        for (int j = 0; j < 3; j++) {
+            vec3 e(j == 0, j == 1, j == 2);
+            vec3 column = rotate(e, u, angle);
+            for (int i = 0; i < 3; i++) a.m[i][j] = column[i];
+        }
+        return a;
+    }
+
+    vec3 apply_vector(const vec3& v) const {
+        return vec3(m[0][0] * v[0] + m[0][1] * v[1] + m[0][2] * v[2],
+                    m[1][0] * v[0] + m[1][1] * v[1] + m[1][2] * v[2],
+                    m[2][0] * v[0] + m[2][1] * v[1] + m[2][2] * v[2]);
+    }
+
+    vec3 apply_point(const vec3& p) const { return apply_vector(p) + offset; }
+
+    // Box around the transformed corners of box
+    aabb apply(const aabb& box) const {
+        aabb result;
+        for (int corner = 0; corner < 8; corner++) {
+            vec3 p(corner & 1 ? box.max().x() : box.min().x(),
+                   corner & 2 ? box.max().y() : box.min().y(),
+                   corner & 4 ? box.max().z() : box.min().z());
+            result.expand(apply_point(p));
+        }
+        return result;
+    }
+
+    // this applied after b
+    affine_transform operator*(const affine_transform& b) const {
+        affine_transform a;
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) {
+                a.m[i][j] = m[i][0] * b.m[0][j] + m[i][1] * b.m[1][j] + m[i][2] * b.m[2][j];
+            }
+        }
+        a.offset = apply_point(b.offset);
+        return a;
+    }
+
+    affine_transform inverse() const;
+
+public:
+    float m[3][3];
+    vec3 offset;
+};
+
+affine_transform affine_transform::inverse() const {
+    // adjugate over determinant
+    float c00 = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+    float c01 = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+    float c02 = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+    float det = m[0][0] * c00 + m[0][1] * c01 + m[0][2] * c02;
+    if (det == 0) {
+        std::cerr << "Transform is singular (zero scale?)" << std::endl;
+        exit(1);
+    }
+    float inv_det = 1 / det;
+
+    affine_transform a;
+    a.m[0][0] = c00 * inv_det;
+    a.m[1][0] = c01 * inv_det;
+    a.m[2][0] = c02 * inv_det;
+    a.m[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * inv_det;
+    a.m[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * inv_det;
+    a.m[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * inv_det;
+    a.m[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * inv_det;
+    a.m[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * inv_det;
+    a.m[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * inv_det;
+    a.offset = -a.apply_vector(offset);
+    return a;
+}
+
+#endif //TRANSFORM_H
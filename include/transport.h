@@ -0,0 +1,81 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include "hittable.h"
+
+#include <algorithm>
+
+// Calls visit(interval, t0, t1) for each stretch [t0, t1] covered by rec's intervals, in order along the ray.
+// Each stretch belongs to the covering interval of highest priority (the last recorded on a tie), so nested or
+// overlapping objects are never counted twice. Stops early when visit returns false.
+template<typename F>
+void for_each_stretch(const hit_record& rec, F visit) {
+    struct endpoint {
+        float t;
+        int interval; // index + 1 for an entry, -(index + 1) for an exit
+    };
+    small_vector<endpoint, 2 * max_inline_hits> endpoints;
+    for (int i = 0; i < rec.intervals.size(); i++) {
+        const path_interval &in = rec.intervals[i];
+        if (!(in.t_out > in.t_in)) continue;
+        endpoints.push_back({in.t_in, i + 1});
+        endpoints.push_back({in.t_out, -(i + 1)});
+    }
+    std::sort(endpoints.begin(), endpoints.end(), [](const endpoint& a, const endpoint& b) { return a.t < b.t; });
+
+    small_vector<int, max_inline_hits> inside; // intervals covering the current stretch
+    for (int e = 0; e + 1 < endpoints.size(); e++) {
+        int id = endpoints[e].interval;
+        if (id > 0) {
+            inside.push_back(id - 1);
+        }
+        else {
+            for (int k = 0; k < inside.size(); k++) {
+                if (inside[k] != -id - 1) continue;
+                inside[k] = inside.back();
+                inside.pop_back();
+                break;
+            }
+        }
+
+        if (inside.empty() || !(endpoints[e + 1].t > endpoints[e].t)) continue;
+
+        int top = inside[0];
+        for (int k = 1; k < inside.size(); k++) {
+            int i = inside[k];
+            if (rec.intervals[i].priority > rec.intervals[top].priority ||
+                (rec.intervals[i].priority == rec.intervals[top].priority && i > top)) top = i;
+        }
+        if (!visit(rec.intervals[top], endpoints[e].t, endpoints[e + 1].t)) return;
+    }
+}
+
+// Transport stage, run once per ray after every object has added its intervals to rec. The path lengths of
+// the stretches are merged per material into rec.segments, and the monoenergetic transmission
+// exp(-sum mu_i d_i) takes a single exp.
+void resolve_transport(const ray& r, hit_record& rec) {
+    rec.segments.clear();
+    rec.trans_prob = 1;
+    if (rec.intervals.empty()) return;
+
+    const float length_scale = r.direction().length();
+    for_each_stretch(rec, [&](const path_interval& in, float t0, float t1) {
+        float length = (t1 - t0) * length_scale * in.scale;
+        for (path_segment &s: rec.segments) {
+            if (s.mat == in.mat) {
+                s.length += length;
+                return true;
+            }
+        }
+        rec.segments.push_back({in.mat, length});
+        return true;
+    });
+
+    float optical_depth = 0;
+    for (const path_segment &s: rec.segments) {
+        optical_depth += s.mat->linear_attenuation() * s.length;
+    }
+    rec.trans_prob = exp(-optical_depth);
+}
+
+#endif //TRANSPORT_H
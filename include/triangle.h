@@ -10,6 +10,7 @@ public:
     triangle(vec3 v0, vec3 v1, vec3 v2, shared_ptr<material> m) : v0(v0), v1(v1), v2(v2), mat_ptr(m) {};
 
     virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
+    virtual bool bounding_box(aabb& output_box) const override;
 
 public:
     vec3 v0;
@@ -46,4 +47,12 @@ bool triangle::hit(const ray &r, float t_min, float t_max, hit_record &rec) cons
 
     return true;
 }
+
+bool triangle::bounding_box(aabb &output_box) const {
+    output_box = aabb();
+    output_box.expand(v0);
+    output_box.expand(v1);
+    output_box.expand(v2);
+    return true;
+}
 #endif //TRIANGLE_H
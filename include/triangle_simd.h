@@ -0,0 +1,198 @@
+#ifndef TRIANGLE_SIMD_H
+#define TRIANGLE_SIMD_H
+
+#include "triangle_store.h"
+#include "ray_packet.h"
+
+// Batched Möller–Trumbore: one ray against several triangles of a triangle_store per instruction. The lane
+// width is picked at compile time, AVX2 (-mavx2) tests 8 triangles at once, SSE2 tests 4, and anything else
+// (or defining XRT_NO_SIMD) falls back to the scalar test. Same arithmetic as triangle_store::intersect.
+
+#if defined(__AVX2__) && !defined(XRT_NO_SIMD)
+#include <immintrin.h>
+const int triangle_batch_width = 8;
+#elif defined(__SSE2__) && !defined(XRT_NO_SIMD)
+#include <emmintrin.h>
+const int triangle_batch_width = 4;
+#else
+const int triangle_batch_width = 1;
+#endif
+
+// Tests the triangle_batch_width triangles starting at first. Bit k of the result is set when triangle
+// first + k is crossed within [t_min, t_max], and t_out[k] then holds its t. Lanes past the end of the store
+// read padding and never hit.
+inline unsigned intersect_batch(const triangle_store& tris, size_t first, const ray& r, float t_min, float t_max,
+                                float* t_out) {
+#if defined(__AVX2__) && !defined(XRT_NO_SIMD)
+    const __m256 dx = _mm256_set1_ps(r.dir.x()), dy = _mm256_set1_ps(r.dir.y()), dz = _mm256_set1_ps(r.dir.z());
+    const __m256 e1x = _mm256_loadu_ps(&tris.e1x[first]), e1y = _mm256_loadu_ps(&tris.e1y[first]), e1z = _mm256_loadu_ps(&tris.e1z[first]);
+    const __m256 e2x = _mm256_loadu_ps(&tris.e2x[first]), e2y = _mm256_loadu_ps(&tris.e2y[first]), e2z = _mm256_loadu_ps(&tris.e2z[first]);
+
+    // pvec = cross(d, e2), det = dot(e1, pvec)
+    __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+    __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+    __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+    __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+    __m256 abs_det = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), det);
+    __m256 mask = _mm256_cmp_ps(abs_det, _mm256_set1_ps(0.0000001f), _CMP_GE_OQ); // not parallel to triangle
+    __m256 inv_det = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+
+    // tvec = origin - v0, u = dot(tvec, pvec) / det
+    __m256 tx = _mm256_sub_ps(_mm256_set1_ps(r.orig.x()), _mm256_loadu_ps(&tris.v0x[first]));
+    __m256 ty = _mm256_sub_ps(_mm256_set1_ps(r.orig.y()), _mm256_loadu_ps(&tris.v0y[first]));
+    __m256 tz = _mm256_sub_ps(_mm256_set1_ps(r.orig.z()), _mm256_loadu_ps(&tris.v0z[first]));
+    __m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tx, px), _mm256_mul_ps(ty, py)), _mm256_mul_ps(tz, pz)), inv_det);
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(u, _mm256_setzero_ps(), _CMP_GE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(u, _mm256_set1_ps(1.0f), _CMP_LE_OQ));
+
+    // qvec = cross(tvec, e1), v = dot(d, qvec) / det, t = dot(e2, qvec) / det
+    __m256 qx = _mm256_sub_ps(_mm256_mul_ps(ty, e1z), _mm256_mul_ps(tz, e1y));
+    __m256 qy = _mm256_sub_ps(_mm256_mul_ps(tz, e1x), _mm256_mul_ps(tx, e1z));
+    __m256 qz = _mm256_sub_ps(_mm256_mul_ps(tx, e1y), _mm256_mul_ps(ty, e1x));
+    __m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)), inv_det);
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(v, _mm256_setzero_ps(), _CMP_GE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_add_ps(u, v), _mm256_set1_ps(1.0f), _CMP_LE_OQ));
+    __m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), inv_det);
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, _mm256_set1_ps(t_min), _CMP_GE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, _mm256_set1_ps(t_max), _CMP_LE_OQ));
+
+    _mm256_storeu_ps(t_out, t);
+    return static_cast<unsigned>(_mm256_movemask_ps(mask));
+#elif defined(__SSE2__) && !defined(XRT_NO_SIMD)
+    const __m128 dx = _mm_set1_ps(r.dir.x()), dy = _mm_set1_ps(r.dir.y()), dz = _mm_set1_ps(r.dir.z());
+    const __m128 e1x = _mm_loadu_ps(&tris.e1x[first]), e1y = _mm_loadu_ps(&tris.e1y[first]), e1z = _mm_loadu_ps(&tris.e1z[first]);
+    const __m128 e2x = _mm_loadu_ps(&tris.e2x[first]), e2y = _mm_loadu_ps(&tris.e2y[first]), e2z = _mm_loadu_ps(&tris.e2z[first]);
+
+    // pvec = cross(d, e2), det = dot(e1, pvec)
+    __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+    __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+    __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+    __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+    __m128 abs_det = _mm_andnot_ps(_mm_set1_ps(-0.0f), det);
+    __m128 mask = _mm_cmpge_ps(abs_det, _mm_set1_ps(0.0000001f)); // not parallel to triangle
+    __m128 inv_det = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+    // tvec = origin - v0, u = dot(tvec, pvec) / det
+    __m128 tx = _mm_sub_ps(_mm_set1_ps(r.orig.x()), _mm_loadu_ps(&tris.v0x[first]));
+    __m128 ty = _mm_sub_ps(_mm_set1_ps(r.orig.y()), _mm_loadu_ps(&tris.v0y[first]));
+    __m128 tz = _mm_sub_ps(_mm_set1_ps(r.orig.z()), _mm_loadu_ps(&tris.v0z[first]));
+    __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), inv_det);
+    mask = _mm_and_ps(mask, _mm_cmpge_ps(u, _mm_setzero_ps()));
+    mask = _mm_and_ps(mask, _mm_cmple_ps(u, _mm_set1_ps(1.0f)));
+
+    // qvec = cross(tvec, e1), v = dot(d, qvec) / det, t = dot(e2, qvec) / det
+    __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+    __m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+    __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+    __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inv_det);
+    mask = _mm_and_ps(mask, _mm_cmpge_ps(v, _mm_setzero_ps()));
+    mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+    __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inv_det);
+    mask = _mm_and_ps(mask, _mm_cmpge_ps(t, _mm_set1_ps(t_min)));
+    mask = _mm_and_ps(mask, _mm_cmple_ps(t, _mm_set1_ps(t_max)));
+
+    _mm_storeu_ps(t_out, t);
+    return static_cast<unsigned>(_mm_movemask_ps(mask));
+#else
+    return tris.intersect(first, r, t_min, t_max, t_out[0]) ? 1u : 0u;
+#endif
+}
+
+// Calls visit(i, t) for every triangle i in [first, first + count) that the ray crosses within [t_min, t_max]
+template<typename F>
+void intersect_range(const triangle_store& tris, size_t first, size_t count, const ray& r, float t_min, float t_max,
+                     F&& visit) {
+    float t_batch[triangle_batch_width];
+    for (size_t k = 0; k < count; k += triangle_batch_width) {
+        unsigned mask = intersect_batch(tris, first + k, r, t_min, t_max, t_batch);
+        if (count - k < triangle_batch_width) {
+            mask &= (1u << (count - k)) - 1; // drop lanes past the end of the range
+        }
+        while (mask) {
+            int lane = __builtin_ctz(mask);
+            visit(first + k + lane, t_batch[lane]);
+            mask &= mask - 1;
+        }
+    }
+}
+
+// Tests triangle i against the packet_lane_width rays of packet starting at lane first, the transpose of
+// intersect_batch for packets. Bit k is set when ray first + k crosses it, t_out[k] then holds its t.
+inline unsigned intersect_packet(const triangle_store& tris, size_t i, const ray_packet& packet, int first,
+                                 float t_min, float t_max, float* t_out) {
+#if defined(__AVX2__) && !defined(XRT_NO_SIMD)
+    const __m256 dx = _mm256_load_ps(packet.dx + first), dy = _mm256_load_ps(packet.dy + first), dz = _mm256_load_ps(packet.dz + first);
+    const __m256 e1x = _mm256_set1_ps(tris.e1x[i]), e1y = _mm256_set1_ps(tris.e1y[i]), e1z = _mm256_set1_ps(tris.e1z[i]);
+    const __m256 e2x = _mm256_set1_ps(tris.e2x[i]), e2y = _mm256_set1_ps(tris.e2y[i]), e2z = _mm256_set1_ps(tris.e2z[i]);
+
+    // pvec = cross(d, e2), det = dot(e1, pvec)
+    __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+    __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+    __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+    __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+    __m256 abs_det = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), det);
+    __m256 mask = _mm256_cmp_ps(abs_det, _mm256_set1_ps(0.0000001f), _CMP_GE_OQ); // not parallel to triangle
+    __m256 inv_det = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+
+    // tvec = origin - v0, u = dot(tvec, pvec) / det
+    __m256 tx = _mm256_sub_ps(_mm256_load_ps(packet.ox + first), _mm256_set1_ps(tris.v0x[i]));
+    __m256 ty = _mm256_sub_ps(_mm256_load_ps(packet.oy + first), _mm256_set1_ps(tris.v0y[i]));
+    __m256 tz = _mm256_sub_ps(_mm256_load_ps(packet.oz + first), _mm256_set1_ps(tris.v0z[i]));
+    __m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tx, px), _mm256_mul_ps(ty, py)), _mm256_mul_ps(tz, pz)), inv_det);
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(u, _mm256_setzero_ps(), _CMP_GE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(u, _mm256_set1_ps(1.0f), _CMP_LE_OQ));
+
+    // qvec = cross(tvec, e1), v = dot(d, qvec) / det, t = dot(e2, qvec) / det
+    __m256 qx = _mm256_sub_ps(_mm256_mul_ps(ty, e1z), _mm256_mul_ps(tz, e1y));
+    __m256 qy = _mm256_sub_ps(_mm256_mul_ps(tz, e1x), _mm256_mul_ps(tx, e1z));
+    __m256 qz = _mm256_sub_ps(_mm256_mul_ps(tx, e1y), _mm256_mul_ps(ty, e1x));
+    __m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)), inv_det);
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(v, _mm256_setzero_ps(), _CMP_GE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_add_ps(u, v), _mm256_set1_ps(1.0f), _CMP_LE_OQ));
+    __m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), inv_det);
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, _mm256_set1_ps(t_min), _CMP_GE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, _mm256_set1_ps(t_max), _CMP_LE_OQ));
+
+    _mm256_storeu_ps(t_out, t);
+    return static_cast<unsigned>(_mm256_movemask_ps(mask));
+#elif defined(__SSE2__) && !defined(XRT_NO_SIMD)
+    const __m128 dx = _mm_load_ps(packet.dx + first), dy = _mm_load_ps(packet.dy + first), dz = _mm_load_ps(packet.dz + first);
+    const __m128 e1x = _mm_set1_ps(tris.e1x[i]), e1y = _mm_set1_ps(tris.e1y[i]), e1z = _mm_set1_ps(tris.e1z[i]);
+    const __m128 e2x = _mm_set1_ps(tris.e2x[i]), e2y = _mm_set1_ps(tris.e2y[i]), e2z = _mm_set1_ps(tris.e2z[i]);
+
+    // pvec = cross(d, e2), det = dot(e1, pvec)
+    __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+    __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+    __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+    __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+    __m128 abs_det = _mm_andnot_ps(_mm_set1_ps(-0.0f), det);
+    __m128 mask = _mm_cmpge_ps(abs_det, _mm_set1_ps(0.0000001f)); // not parallel to triangle
+    __m128 inv_det = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+    // tvec = origin - v0, u = dot(tvec, pvec) / det
+    __m128 tx = _mm_sub_ps(_mm_load_ps(packet.ox + first), _mm_set1_ps(tris.v0x[i]));
+    __m128 ty = _mm_sub_ps(_mm_load_ps(packet.oy + first), _mm_set1_ps(tris.v0y[i]));
+    __m128 tz = _mm_sub_ps(_mm_load_ps(packet.oz + first), _mm_set1_ps(tris.v0z[i]));
+    __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), inv_det);
+    mask = _mm_and_ps(mask, _mm_cmpge_ps(u, _mm_setzero_ps()));
+    mask = _mm_and_ps(mask, _mm_cmple_ps(u, _mm_set1_ps(1.0f)));
+
+    // qvec = cross(tvec, e1), v = dot(d, qvec) / det, t = dot(e2, qvec) / det
+    __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+    __m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+    __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+    __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inv_det);
+    mask = _mm_and_ps(mask, _mm_cmpge_ps(v, _mm_setzero_ps()));
+    mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+    __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inv_det);
+    mask = _mm_and_ps(mask, _mm_cmpge_ps(t, _mm_set1_ps(t_min)));
+    mask = _mm_and_ps(mask, _mm_cmple_ps(t, _mm_set1_ps(t_max)));
+
+    _mm_storeu_ps(t_out, t);
+    return static_cast<unsigned>(_mm_movemask_ps(mask));
+#else
+    return tris.intersect(i, packet.rays[first], t_min, t_max, t_out[0]) ? 1u : 0u;
+#endif
+}
+
+#endif //TRIANGLE_SIMD_H
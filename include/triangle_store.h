@@ -0,0 +1,153 @@
+#ifndef TRIANGLE_STORE_H
+#define TRIANGLE_STORE_H
+
+#include "aabb.h"
+
+#include <vector>
+
+// Triangles of a mesh as structure-of-arrays: the first vertex and the two edges leaving it, precomputed once
+// at load so that intersection reads straight from contiguous arrays. Every array is followed by padding
+// zeros (degenerate triangles that never hit), so vector kernels may load a full batch past the last triangle.
+class triangle_store {
+public:
+    static const int padding = 8;
+
+    triangle_store() { clear(); }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    void reserve(size_t n);
+    void clear();
+    void add(const vec3& v0, const vec3& v1, const vec3& v2);
+    void truncate(size_t n); // keeps the first n triangles
+
+    vec3 vertex(size_t i, int corner) const;
+    aabb bounding_box(size_t i) const;
+
+    // Möller–Trumbore test of triangle i, t is set when the ray crosses it within [t_min, t_max]
+    bool intersect(size_t i, const ray& r, float t_min, float t_max, float& t) const;
+
+    // Permutes the triangles so that new triangle k is old triangle order[k]
+    void reorder(const std::vector<int>& order);
+
+    // Replaces the contents with n triangles given as 9 consecutive columns of n floats, v0x first
+    void assign_columns(const float* data, size_t n);
+
+    void translate(const vec3& offset);
+
+public:
+    std::vector<float> v0x, v0y, v0z;
+    std::vector<float> e1x, e1y, e1z; // v1 - v0
+    std::vector<float> e2x, e2y, e2z; // v2 - v0
+
+private:
+    size_t count = 0;
+
+    array<std::vector<float>*, 9> columns() {
+        return {&v0x, &v0y, &v0z, &e1x, &e1y, &e1z, &e2x, &e2y, &e2z};
+    }
+};
+
+void triangle_store::reserve(size_t n) {
+    for (auto column: columns()) {
+        column->reserve(n + padding);
+    }
+}
+
+void triangle_store::clear() {
+    for (auto column: columns()) {
+        column->assign(padding, 0.0f);
+    }
+    count = 0;
+}
+
+void triangle_store::add(const vec3& v0, const vec3& v1, const vec3& v2) {
+    vec3 e1 = v1 - v0;
+    vec3 e2 = v2 - v0;
+    float values[9] = {v0.x(), v0.y(), v0.z(), e1.x(), e1.y(), e1.z(), e2.x(), e2.y(), e2.z()};
+    auto cols = columns();
+    for (int c = 0; c < 9; c++) {
+        (*cols[c])[count] = values[c]; // overwrite the first padding slot and grow the padding back
+        cols[c]->push_back(0.0f);
+    }
+    count++;
+}
+
+void triangle_store::truncate(size_t n) {
+    if (n >= count) return;
+    for (auto column: columns()) {
+        column->resize(n);
+        column->resize(n + padding, 0.0f);
+    }
+    count = n;
+}
+
+vec3 triangle_store::vertex(size_t i, int corner) const {
+    vec3 v0(v0x[i], v0y[i], v0z[i]);
+    if (corner == 1) return v0 + vec3(e1x[i], e1y[i], e1z[i]);
+    if (corner == 2) return v0 + vec3(e2x[i], e2y[i], e2z[i]);
+    return v0;
+}
+
+aabb triangle_store::bounding_box(size_t i) const {
+    aabb box;
+    for (int corner = 0; corner < 3; corner++) {
+        box.expand(vertex(i, corner));
+    }
+    return box;
+}
+
+bool triangle_store::intersect(size_t i, const ray& r, float t_min, float t_max, float& t) const {
+    float kEpsilon = 0.0000001;
+
+    vec3 e1(e1x[i], e1y[i], e1z[i]);
+    vec3 e2(e2x[i], e2y[i], e2z[i]);
+    vec3 pvec = cross(r.direction(), e2);
+    float det = dot(e1, pvec);
+
+    if (std::abs(det) < kEpsilon) return false;  // ray is parallel to triangle
+
+    float inv_det = 1.0 / det;
+
+    vec3 tvec = r.origin() - vec3(v0x[i], v0y[i], v0z[i]);
+    float u = dot(tvec, pvec) * inv_det;
+    if (u < 0.0 || u > 1.0) return false; // hit point is outside of triangle
+
+    vec3 qvec = cross(tvec, e1);
+    float v = dot(r.direction(), qvec) * inv_det;
+    if (v < 0.0 || u + v > 1.0) return false; // hit point is outside of triangle
+
+    t = dot(e2, qvec) * inv_det;
+    return t >= t_min && t <= t_max; // hit point must lie on the ray segment
+}
+
+void triangle_store::reorder(const std::vector<int>& order) {
+    for (auto column: columns()) { // one column at a time keeps the extra memory to a single array
+        // a new array per column, so each ends up exactly sized whatever capacity was reserved while loading
+        std::vector<float> reordered(order.size() + padding, 0.0f);
+        for (size_t k = 0; k < order.size(); k++) {
+            reordered[k] = (*column)[order[k]];
+        }
+        column->swap(reordered);
+    }
+}
+
+void triangle_store::assign_columns(const float* data, size_t n) {
+    for (auto column: columns()) {
+        column->assign(data, data + n);
+        column->resize(n + padding, 0.0f);
+        data += n;
+    }
+    count = n;
+}
+
+void triangle_store::translate(const vec3& offset) {
+    for (size_t i = 0; i < count; i++) {
+        v0x[i] += offset.x();
+        v0y[i] += offset.y();
+        v0z[i] += offset.z();
+    }
+}
+
+#endif //TRIANGLE_STORE_H
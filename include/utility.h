@@ -1,6 +1,7 @@
 #ifndef UTILITY_H
 #define UTILITY_H
 
+#include <algorithm>
 #include <cmath>
 #include <limits>
 #include <memory>
@@ -29,12 +30,11 @@ inline double degrees_to_radians(double degrees) {
     return degrees * pi / 180.0;
 }
 
-float interpolate(const std::vector<float>& x, const std::vector<float>& y, float x_val) {
+float interpolate(const float* x, const float* y, size_t n, float x_val) {
     // find the index i such that x[i] <= x_val <= x[i+1]
-    int i = 0;
-    while (i < x.size() - 1 && x[i+1] < x_val) {
-        i++;
-    }
+    size_t i = std::lower_bound(x, x + n, x_val) - x;
+    i = i > 0 ? i - 1 : 0;
+    if (i > n - 2) i = n - 2;
 
     // linear interpolation of y[i] and y[i+1] at x_val
     float x1 = x[i];
@@ -44,6 +44,10 @@ float interpolate(const std::vector<float>& x, const std::vector<float>& y, floa
     return y1 + (x_val - x1) * (y2 - y1) / (x2 - x1);
 }
 
+float interpolate(const std::vector<float>& x, const std::vector<float>& y, float x_val) {
+    return interpolate(x.data(), y.data(), x.size(), x_val);
+}
+
 // Common Headers
 
 #include "ray.h"
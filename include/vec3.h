@@ -102,6 +102,13 @@ inline vec3 unit_vector(vec3 v) {
     return v / v.length();
 }
 
+// Rotates v by angle radians about the unit vector axis (Rodrigues' formula)
+inline vec3 rotate(const vec3 &v, const vec3 &axis, float angle) {
+    float c = std::cos(angle);
+    float s = std::sin(angle);
+    return v * c + cross(axis, v) * s + axis * (dot(axis, v) * (1 - c));
+}
+
 inline vec3 vectortoVec3(const float *v) {
     return vec3(v[0], v[1], v[2]);
 }
@@ -0,0 +1,250 @@
+#ifndef VOXEL_VOLUME_H
+#define VOXEL_VOLUME_H
+
+#include "hittable.h"
+#include "mapped_file.h"
+
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+// Voxel phantom read from a MetaImage header (.mhd) and its raw data file, which is memory-mapped. Voxels are
+// either material labels (MET_UCHAR, MET_USHORT), each label mapped to a material, or densities [g/cm^3]
+// (MET_FLOAT) of a single material. Rays are marched voxel by voxel with the Amanatides–Woo traversal, so the
+// cost is proportional to the voxels actually crossed. Runs of voxels with the same label, or the same density,
+// become one path_interval each. Density intervals are scaled by density / rho_material, empty voxels give none.
+//
+// As in the MetaImage convention, ElementSpacing and Offset (the centre of the first voxel) are in mm.
+class voxel_volume : public hittable {
+public:
+    // Labelled phantom, labels missing from label_materials are treated as vacuum
+    voxel_volume(const string& header_file, const std::map<int, shared_ptr<material>>& label_materials, vec3 position);
+    // Density phantom of one material
+    voxel_volume(const string& header_file, shared_ptr<material> m, vec3 position);
+
+    virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
+    virtual bool bounding_box(aabb& output_box) const override;
+
+public:
+    enum voxel_type { uint8_voxels, uint16_voxels, float32_voxels };
+
+    int dims[3];
+    vec3 spacing; // voxel size [cm]
+    vec3 corner;  // world position of the low corner of voxel (0, 0, 0) [cm]
+    voxel_type type;
+    std::vector<shared_ptr<material>> materials; // one slot per mapped label, or the density material
+    std::vector<int> label_slot;                 // label -> slot in materials, -1 for vacuum
+
+private:
+    mapped_file data;
+    bool density_mode;
+
+    void read_header(const string& header_file, vec3 position);
+
+    // Calls visit(value, t0, t1) for every voxel crossed between t_enter and t_exit, in order along the ray
+    template<typename T, typename F>
+    void march(const ray& r, float t_enter, float t_exit, F&& visit) const;
+};
+
+voxel_volume::voxel_volume(const string& header_file, const std::map<int, shared_ptr<material>>& label_materials,
+                           vec3 position) : density_mode(false) {
+    read_header(header_file, position);
+    if (type == float32_voxels) {
+        std::cerr << header_file << ": float voxels hold densities, give a single material instead of labels" << std::endl;
+        exit(1);
+    }
+
+    label_slot.assign(type == uint8_voxels ? 256 : 65536, -1);
+    for (const auto &entry: label_materials) {
+        if (entry.first < 0 || entry.first >= label_slot.size()) continue;
+        label_slot[entry.first] = static_cast<int>(materials.size());
+        materials.push_back(entry.second);
+    }
+}
+
+voxel_volume::voxel_volume(const string& header_file, shared_ptr<material> m, vec3 position) : density_mode(true) {
+    read_header(header_file, position);
+    if (type != float32_voxels) {
+        std::cerr << header_file << ": label voxels need a material per label" << std::endl;
+        exit(1);
+    }
+    materials.push_back(m);
+}
+
+void voxel_volume::read_header(const string& header_file, vec3 position) {
+    std::ifstream file(header_file);
+    if (!file) {
+        std::cerr << "Error opening file " << header_file << std::endl;
+        exit(1);
+    }
+
+    std::map<string, string> fields;
+    string line;
+    while (std::getline(file, line)) {
+        size_t equals = line.find('=');
+        if (equals == string::npos) continue;
+        auto trim = [](string s) {
+            s.erase(0, s.find_first_not_of(" \t\r"));
+            s.erase(s.find_last_not_of(" \t\r") + 1);
+            return s;
+        };
+        fields[trim(line.substr(0, equals))] = trim(line.substr(equals + 1));
+    }
+
+    std::istringstream dim_size(fields["DimSize"]);
+    if (!(dim_size >> dims[0] >> dims[1] >> dims[2]) || dims[0] <= 0 || dims[1] <= 0 || dims[2] <= 0) {
+        std::cerr << header_file << ": DimSize must give three voxel counts" << std::endl;
+        exit(1);
+    }
+
+    float s[3] = {1, 1, 1}, offset[3] = {0, 0, 0};
+    std::istringstream spacing_field(fields.count("ElementSpacing") ? fields["ElementSpacing"] : fields["ElementSize"]);
+    spacing_field >> s[0] >> s[1] >> s[2];
+    std::istringstream offset_field(fields.count("Offset") ? fields["Offset"] : fields["Position"]);
+    offset_field >> offset[0] >> offset[1] >> offset[2];
+    spacing = 0.1f * vec3(s[0], s[1], s[2]);                                  // mm to cm
+    corner = 0.1f * vec3(offset[0], offset[1], offset[2]) - 0.5f * spacing + position; // offset is a voxel centre
+
+    string element_type = fields["ElementType"];
+    size_t element_size;
+    if (element_type == "MET_UCHAR") { type = uint8_voxels; element_size = 1; }
+    else if (element_type == "MET_USHORT") { type = uint16_voxels; element_size = 2; }
+    else if (element_type == "MET_FLOAT") { type = float32_voxels; element_size = 4; }
+    else {
+        std::cerr << header_file << ": unsupported ElementType " << element_type << std::endl;
+        exit(1);
+    }
+
+    string data_file = fields["ElementDataFile"];
+    size_t slash = header_file.find_last_of('/');
+    if (!data_file.empty() && data_file[0] != '/' && slash != string::npos) {
+        data_file = header_file.substr(0, slash + 1) + data_file; // relative to the header
+    }
+    size_t expected = element_size * dims[0] * dims[1] * dims[2];
+    if (!data.open(data_file) || data.size() < expected) {
+        std::cerr << "Error mapping " << expected << " bytes of voxel data from " << data_file << std::endl;
+        exit(1);
+    }
+
+    std::cout << "<Voxel Volume>\n" << header_file << ": " << dims[0] << "x" << dims[1] << "x" << dims[2] << " "
+              << element_type << " voxels of " << spacing << " cm\n" << std::endl;
+}
+
+bool voxel_volume::bounding_box(aabb& output_box) const {
+    output_box = aabb(corner, corner + vec3(dims[0] * spacing.x(), dims[1] * spacing.y(), dims[2] * spacing.z()));
+    return true;
+}
+
+bool voxel_volume::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+    // clip the ray to the volume
+    aabb box;
+    bounding_box(box);
+    float t_enter = t_min, t_exit = t_max;
+    for (int a = 0; a < 3; a++) {
+        float inv_d = 1.0f / r.dir[a];
+        float t0 = (box.minimum[a] - r.orig[a]) * inv_d;
+        float t1 = (box.maximum[a] - r.orig[a]) * inv_d;
+        if (inv_d < 0.0f) std::swap(t0, t1);
+        t_enter = t0 > t_enter ? t0 : t_enter;
+        t_exit = t1 < t_exit ? t1 : t_exit;
+        if (t_exit <= t_enter) return false;
+    }
+
+    size_t first_interval = rec.intervals.size();
+    if (density_mode) {
+        // consecutive voxels of the same density are merged, so an object overlapping part of the volume takes
+        // the place of the matter actually there, and gaps stay empty
+        const material *m = materials[0].get();
+        float run_density = 0, run_start = 0, run_end = 0;
+        auto close_run = [&]() {
+            if (run_density > 0 && run_end > run_start) {
+                rec.intervals.push_back({m, run_start, run_end, priority, run_density / m->density()});
+            }
+        };
+        march<float>(r, t_enter, t_exit, [&](float density, float t0, float t1) {
+            if (!(density > 0)) density = 0; // negative or NaN voxels are vacuum
+            if (density != run_density) {
+                close_run();
+                run_density = density;
+                run_start = t0;
+            }
+            run_end = t1;
+        });
+        close_run();
+    }
+    else {
+        // consecutive voxels of the same material are merged into one interval
+        int run_slot = -1;
+        float run_start = 0, run_end = 0;
+        auto close_run = [&]() {
+            if (run_slot >= 0 && run_end > run_start) {
+                rec.intervals.push_back({materials[run_slot].get(), run_start, run_end, priority, 1});
+            }
+        };
+        auto visit = [&](float label, float t0, float t1) {
+            int slot = label_slot[static_cast<int>(label)];
+            if (slot != run_slot) {
+                close_run();
+                run_slot = slot;
+                run_start = t0;
+            }
+            run_end = t1;
+        };
+        if (type == uint8_voxels) march<uint8_t>(r, t_enter, t_exit, visit);
+        else march<uint16_t>(r, t_enter, t_exit, visit);
+        close_run();
+    }
+    if (rec.intervals.size() == first_interval) return false; // only vacuum voxels
+
+    rec.t.push_back(t_enter);
+    rec.t.push_back(t_exit);
+    rec.p.push_back(r.at(t_enter));
+    rec.p.push_back(r.at(t_exit));
+    return true;
+}
+
+template<typename T, typename F>
+void voxel_volume::march(const ray& r, float t_enter, float t_exit, F&& visit) const {
+    const T *voxels = reinterpret_cast<const T*>(data.data());
+    vec3 entry = r.at(t_enter) - corner;
+
+    int index[3], step[3];
+    float t_next[3], t_delta[3];
+    for (int a = 0; a < 3; a++) {
+        index[a] = static_cast<int>(std::floor(entry[a] / spacing[a]));
+        index[a] = std::max(0, std::min(dims[a] - 1, index[a])); // entry point can round just outside the box
+        if (r.dir[a] > 0) {
+            step[a] = 1;
+            t_next[a] = t_enter + ((index[a] + 1) * spacing[a] - entry[a]) / r.dir[a];
+            t_delta[a] = spacing[a] / r.dir[a];
+        }
+        else if (r.dir[a] < 0) {
+            step[a] = -1;
+            t_next[a] = t_enter + (index[a] * spacing[a] - entry[a]) / r.dir[a];
+            t_delta[a] = -spacing[a] / r.dir[a];
+        }
+        else {
+            step[a] = 0;
+            t_next[a] = infinity;
+            t_delta[a] = infinity;
+        }
+    }
+
+    float t = t_enter;
+    while (t < t_exit) {
+        int axis = t_next[0] < t_next[1] ? (t_next[0] < t_next[2] ? 0 : 2) : (t_next[1] < t_next[2] ? 1 : 2);
+        float t_leave = std::min(t_next[axis], t_exit);
+
+        T value = voxels[(static_cast<size_t>(index[2]) * dims[1] + index[1]) * dims[0] + index[0]];
+        visit(static_cast<float>(value), t, t_leave);
+
+        t = t_leave;
+        index[axis] += step[axis];
+        if (index[axis] < 0 || index[axis] >= dims[axis]) break;
+        t_next[axis] += t_delta[axis];
+    }
+}
+
+#endif //VOXEL_VOLUME_H
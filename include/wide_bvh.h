@@ -0,0 +1,304 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+#include "bvh.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) && !defined(XRT_NO_SIMD)
+#include <emmintrin.h>
+#endif
+
+// Four children of a wide_bvh node in one 64 byte cache line. Child bounds are 8 bit steps of 2^exponent from
+// origin per axis, rounded outwards, so every child box holds the exact box it was made from.
+struct alignas(64) wide_bvh_node {
+    float origin[3];
+    int8_t exponent[3];
+    uint8_t child_mask;  // bit k is set when child k is used
+    uint8_t lo[3][4];    // per axis, per child
+    uint8_t hi[3][4];
+    int32_t child[4];    // node index of an interior child, or first primitive of a leaf
+    uint16_t count[4];   // number of primitives in a leaf child, 0 for interior children
+
+    // 2^exponent[axis], built from its bits (exponents are kept within the normal float range)
+    float scale(int axis) const {
+        uint32_t bits = uint32_t(exponent[axis] + 127) << 23;
+        float s;
+        std::memcpy(&s, &bits, sizeof(s));
+        return s;
+    }
+
+    // q * scale is exact, so this is the same float with or without a fused multiply-add
+    float bound(int axis, uint8_t q) const { return origin[axis] + float(q) * scale(axis); }
+
+    aabb child_box(int k) const {
+        return aabb(vec3(bound(0, lo[0][k]), bound(1, lo[1][k]), bound(2, lo[2][k])),
+                    vec3(bound(0, hi[0][k]), bound(1, hi[1][k]), bound(2, hi[2][k])));
+    }
+};
+
+static_assert(sizeof(wide_bvh_node) == 64, "a wide_bvh_node must fill exactly one cache line");
+
+// Four-wide BVH collapsed from a binary bvh, for tracing large meshes: each node visited is one cache line that
+// holds the boxes of all its children, which are tested at once with SSE, and the tree takes about a third less
+// memory than the binary one. Leaves keep the primitive ranges of the binary tree.
+//
+// The quantized boxes are only slightly larger than the exact ones, a ray may reach a few more leaves but
+// never fewer, so callers collecting every intersection along the ray get the same ones as from the bvh.
+class wide_bvh {
+public:
+    static const int width = 4;
+    static const int max_leaf_size = 65535;
+
+    wide_bvh() {}
+
+    // Collapses tree, already in its final place (the quantized boxes cannot be moved). Returns false, and
+    // stays empty, when a leaf holds more than max_leaf_size primitives or a box is not finite.
+    bool build(const bvh& tree);
+
+    bool empty() const { return nodes.empty(); }
+    aabb bounds() const { return box; }
+
+    // Same as bvh::traverse_leaves(), visit(first, count) for every leaf crossed within [t_min, t_max]
+    template<typename F>
+    void traverse_leaves(const ray& r, float t_min, float t_max, F&& visit) const;
+
+    // Same as bvh::traverse_packet(), child boxes are tested for the whole packet until fewer than
+    // min_packet_rays rays are left in a subtree
+    template<typename F>
+    void traverse_packet(const ray_packet& packet, float t_min, float t_max, F&& visit) const;
+
+public:
+    std::vector<wide_bvh_node> nodes;
+
+private:
+    static const int max_depth = 64; // as in bvh, a wide node is at least one binary level below its parent
+    static const int max_stack = (width - 1) * max_depth + 2;
+    static const int min_packet_rays = 4;
+
+    aabb box; // exact bounds of the root
+
+    // Appends the wide node over binary node index and its subtree, returns its index or -1 on failure
+    int collapse(const bvh& tree, int index, int depth);
+
+    // Rounds the child bounds on one axis outwards to steps of 2^exponent from origin, false if they do not fit
+    static bool quantize(float origin, int exponent, const float* lo, const float* hi, int n, uint8_t* q_lo,
+                         uint8_t* q_hi);
+
+    // Bit k is set when the ray crosses child k of node within [t_min, t_max], same slab test as aabb::hit
+    static unsigned hit_children(const wide_bvh_node& node, const vec3& origin, const vec3& inv_dir, float t_min,
+                                 float t_max);
+
+    template<typename F>
+    void traverse_leaves_from(int root, const vec3& origin, const vec3& inv_dir, float t_min, float t_max,
+                              F&& visit) const;
+};
+
+bool wide_bvh::build(const bvh& tree) {
+    nodes.clear();
+    box = aabb();
+    if (tree.empty()) return false;
+
+    nodes.reserve(tree.nodes.size() / 3 + 1); // 2n - 1 binary nodes over n leaves, about n / 3 wide ones
+    if (collapse(tree, 0, 0) < 0) {
+        std::vector<wide_bvh_node>().swap(nodes);
+        return false;
+    }
+    nodes.shrink_to_fit();
+    box = tree.bounds();
+    return true;
+}
+
+int wide_bvh::collapse(const bvh& tree, int index, int depth) {
+    if (depth > max_depth) return -1;
+
+    // open the interior child of largest area until there are width children, a leaf root is the only child
+    int slots[width], n = 0;
+    const bvh_node &node = tree.nodes[index];
+    if (node.count > 0) {
+        slots[n++] = index;
+    }
+    else {
+        slots[n++] = node.left_first;
+        slots[n++] = node.left_first + 1;
+    }
+    while (n < width) {
+        int best = -1;
+        float best_area = -1;
+        for (int k = 0; k < n; k++) {
+            const bvh_node &child = tree.nodes[slots[k]];
+            if (child.count == 0 && child.box.surface_area() > best_area) {
+                best = k;
+                best_area = child.box.surface_area();
+            }
+        }
+        if (best < 0) break;
+
+        int left = tree.nodes[slots[best]].left_first;
+        for (int k = n; k > best + 1; k--) slots[k] = slots[k - 1];
+        slots[best] = left;
+        slots[best + 1] = left + 1;
+        n++;
+    }
+
+    wide_bvh_node wide = {};
+    float lo[3][width], hi[3][width];
+    for (int k = 0; k < n; k++) {
+        const aabb &child = tree.nodes[slots[k]].box;
+        for (int a = 0; a < 3; a++) {
+            if (!std::isfinite(child.minimum[a]) || !std::isfinite(child.maximum[a])) return -1;
+            lo[a][k] = child.minimum[a];
+            hi[a][k] = child.maximum[a];
+        }
+    }
+
+    // the smallest step that spans the children in 8 bits, a larger one if rounding pushes the top past 255
+    for (int a = 0; a < 3; a++) {
+        wide.origin[a] = *std::min_element(lo[a], lo[a] + n);
+        float extent = *std::max_element(hi[a], hi[a] + n) - wide.origin[a];
+        int exponent = extent > 0 ? std::max(-126, std::ilogb(extent) - 7) : -126;
+        while (exponent <= 127 && !quantize(wide.origin[a], exponent, lo[a], hi[a], n, wide.lo[a], wide.hi[a])) {
+            exponent++;
+        }
+        if (exponent > 127) return -1;
+        wide.exponent[a] = static_cast<int8_t>(exponent);
+    }
+
+    int wide_index = nodes.size();
+    nodes.push_back(wide);
+    for (int k = 0; k < n; k++) {
+        const bvh_node &child = tree.nodes[slots[k]];
+        int target, count = child.count;
+        if (count > max_leaf_size) return -1;
+        if (count > 0) {
+            target = child.left_first;
+        }
+        else {
+            target = collapse(tree, slots[k], depth + 1);
+            if (target < 0) return -1;
+        }
+        nodes[wide_index].child[k] = target; // not through a reference, collapse() may have moved the nodes
+        nodes[wide_index].count[k] = static_cast<uint16_t>(count);
+        nodes[wide_index].child_mask |= 1 << k;
+    }
+    return wide_index;
+}
+
+bool wide_bvh::quantize(float origin, int exponent, const float* lo, const float* hi, int n, uint8_t* q_lo,
+                        uint8_t* q_hi) {
+    wide_bvh_node step = {};
+    step.origin[0] = origin;
+    step.exponent[0] = static_cast<int8_t>(exponent);
+    double scale = step.scale(0);
+
+    for (int k = 0; k < n; k++) {
+        double low = std::floor((double(lo[k]) - origin) / scale), high = std::ceil((double(hi[k]) - origin) / scale);
+        if (high > 255) return false;
+
+        // the estimates are in double, step to the exact float bound in the rounding direction
+        int l = static_cast<int>(std::max(0.0, low)), h = static_cast<int>(std::max(0.0, high));
+        while (l > 0 && step.bound(0, l) > lo[k]) l--;
+        while (h < 255 && step.bound(0, h) < hi[k]) h++;
+        if (step.bound(0, h) < hi[k]) return false;
+        q_lo[k] = static_cast<uint8_t>(l);
+        q_hi[k] = static_cast<uint8_t>(h);
+    }
+    return true;
+}
+
+unsigned wide_bvh::hit_children(const wide_bvh_node& node, const vec3& origin, const vec3& inv_dir, float t_min,
+                                float t_max) {
+#if defined(__SSE2__) && !defined(XRT_NO_SIMD)
+    const __m128i zero = _mm_setzero_si128();
+    auto widen = [&](const uint8_t* q) {
+        int32_t bytes;
+        std::memcpy(&bytes, q, sizeof(bytes));
+        __m128i words = _mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero);
+        return _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+    };
+
+    __m128 near = _mm_set1_ps(t_min), far = _mm_set1_ps(t_max);
+    for (int a = 0; a < 3; a++) {
+        __m128 base = _mm_set1_ps(node.origin[a]), scale = _mm_set1_ps(node.scale(a));
+        __m128 lo = _mm_add_ps(base, _mm_mul_ps(widen(node.lo[a]), scale));
+        __m128 hi = _mm_add_ps(base, _mm_mul_ps(widen(node.hi[a]), scale));
+        __m128 o = _mm_set1_ps(origin[a]), inv = _mm_set1_ps(inv_dir[a]);
+        __m128 t0 = _mm_mul_ps(_mm_sub_ps(lo, o), inv), t1 = _mm_mul_ps(_mm_sub_ps(hi, o), inv);
+        if (inv_dir[a] < 0.0f) std::swap(t0, t1);
+        near = _mm_max_ps(t0, near); // NaN slabs keep the previous bound, like the scalar test
+        far = _mm_min_ps(t1, far);
+    }
+    return _mm_movemask_ps(_mm_cmpnlt_ps(far, near)) & node.child_mask;
+#else
+    unsigned hits = 0;
+    for (int k = 0; k < width; k++) {
+        if ((node.child_mask >> k & 1) && node.child_box(k).hit(origin, inv_dir, t_min, t_max)) hits |= 1u << k;
+    }
+    return hits;
+#endif
+}
+
+template<typename F>
+void wide_bvh::traverse_leaves(const ray& r, float t_min, float t_max, F&& visit) const {
+    if (nodes.empty()) return;
+
+    vec3 d = r.direction();
+    traverse_leaves_from(0, r.origin(), vec3(1.0f / d.x(), 1.0f / d.y(), 1.0f / d.z()), t_min, t_max, visit);
+}
+
+template<typename F>
+void wide_bvh::traverse_leaves_from(int root, const vec3& origin, const vec3& inv_dir, float t_min, float t_max,
+                                    F&& visit) const {
+    int stack[max_stack];
+    int stack_size = 0;
+    stack[stack_size++] = root;
+
+    while (stack_size > 0) {
+        const wide_bvh_node& node = nodes[stack[--stack_size]];
+        for (unsigned hits = hit_children(node, origin, inv_dir, t_min, t_max); hits; hits &= hits - 1) {
+            int k = __builtin_ctz(hits);
+            if (node.count[k] > 0) visit(node.child[k], node.count[k]);
+            else stack[stack_size++] = node.child[k];
+        }
+    }
+}
+
+template<typename F>
+void wide_bvh::traverse_packet(const ray_packet& packet, float t_min, float t_max, F&& visit) const {
+    if (nodes.empty() || packet.size == 0) return;
+
+    struct entry { int node; uint64_t mask; };
+    entry stack[max_stack];
+    int stack_size = 0;
+    stack[stack_size++] = {0, packet.all()};
+
+    while (stack_size > 0) {
+        entry e = stack[--stack_size];
+
+        if (__builtin_popcountll(e.mask) < min_packet_rays) {
+            // the packet has diverged, trace what is left of it as single rays
+            for (uint64_t mask = e.mask; mask; mask &= mask - 1) {
+                int i = __builtin_ctzll(mask);
+                vec3 inv_dir(packet.ix[i], packet.iy[i], packet.iz[i]);
+                traverse_leaves_from(e.node, packet.rays[i].orig, inv_dir, t_min, t_max, [&](int first, int count) {
+                    visit(first, count, uint64_t(1) << i);
+                });
+            }
+            continue;
+        }
+
+        const wide_bvh_node& node = nodes[e.node];
+        for (int k = 0; k < width; k++) {
+            if (!(node.child_mask >> k & 1)) continue;
+            uint64_t mask = box_hit_packet(node.child_box(k), packet, e.mask, t_min, t_max);
+            if (!mask) continue;
+
+            if (node.count[k] > 0) visit(node.child[k], node.count[k], mask);
+            else stack[stack_size++] = {node.child[k], mask};
+        }
+    }
+}
+
+#endif //WIDE_BVH_H
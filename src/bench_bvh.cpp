@@ -0,0 +1,80 @@
+// BVH build time, tree statistics and ray traversal throughput for one mesh, binary against 4-wide.
+//
+// Build:
+//   g++ -std=c++17 -O2 -mavx2 -pthread -Iinclude src/bench_bvh.cpp -o bench_bvh
+// Run from the repository root:
+//   ./bench_bvh [stl file] [number of rays] [build threads, 0 for all]
+
+#include "utility.h"
+
+#include "mesh.h"
+#include <chrono>
+#include <random>
+
+using std::chrono::steady_clock;
+
+double seconds_since(steady_clock::time_point start) {
+    return std::chrono::duration<double>(steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[]) {
+    const char* filename = argc > 1 ? argv[1] : "stl/ancient_chinese_coin.stl";
+    int num_rays = argc > 2 ? std::atoi(argv[2]) : 200000;
+    bvh::set_build_threads(argc > 3 ? std::atoi(argv[3]) : 0);
+    mesh_cache::set_enabled(false);
+    mesh::set_wide_bvh(false); // keep the binary tree, the wide one is made from it here
+
+    mesh object(filename, vec3(0, 0, 0), nullptr);
+    bvh_stats stats = object.tree.statistics();
+    aabb bounds = object.tree.bounds();
+    auto start = steady_clock::now();
+    wide_bvh wide;
+    wide.build(object.tree);
+    double collapse_time = seconds_since(start);
+
+    // rays from a point source through random points of the mesh bounds
+    std::mt19937 gen(1);
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    vec3 extent = bounds.max() - bounds.min();
+    vec3 source = bounds.centroid() + vec3(0, 0, 4 * extent.length());
+    std::vector<ray> rays;
+    for (int i = 0; i < num_rays; i++) {
+        vec3 target = bounds.min() + vec3(dist(gen), dist(gen), dist(gen)) * extent;
+        rays.push_back(ray(source, target - source));
+    }
+
+    size_t leaves = 0, hits = 0, wide_leaves = 0, wide_hits = 0;
+    start = steady_clock::now();
+    for (const ray &r: rays) {
+        object.tree.traverse_leaves(r, 0, infinity, [&](int first, int count) {
+            leaves++;
+            intersect_range(object.triangles, first, count, r, 0, infinity, [&](size_t, float) { hits++; });
+        });
+    }
+    double trace_time = seconds_since(start);
+
+    start = steady_clock::now();
+    for (const ray &r: rays) {
+        wide.traverse_leaves(r, 0, infinity, [&](int first, int count) {
+            wide_leaves++;
+            intersect_range(object.triangles, first, count, r, 0, infinity, [&](size_t, float) { wide_hits++; });
+        });
+    }
+    double wide_time = seconds_since(start);
+
+    // the binary tree needs prim_indices too, the wide one only its nodes
+    double binary_mb = (object.tree.nodes.size() * sizeof(bvh_node) + object.tree.prim_indices.size() * sizeof(int))
+                       / 1E6;
+    double wide_mb = wide.nodes.size() * sizeof(wide_bvh_node) / 1E6;
+
+    cout << filename << ": " << object.triangles.size() << " triangles\n"
+         << "build:    " << stats.build_seconds << " s\n"
+         << "nodes:    " << stats.nodes << " (" << stats.leaves << " leaves), depth " << stats.depth << "\n"
+         << "SAH cost: " << stats.sah_cost << "\n"
+         << "trace:    " << num_rays / trace_time / 1E6 << " M rays/s, " << double(leaves) / num_rays
+         << " leaves per ray, " << hits << " hits, " << binary_mb << " MB\n"
+         << "wide:     " << wide.nodes.size() << " nodes, collapsed in " << collapse_time << " s\n"
+         << "trace:    " << num_rays / wide_time / 1E6 << " M rays/s, " << double(wide_leaves) / num_rays
+         << " leaves per ray, " << wide_hits << " hits, " << wide_mb << " MB" << endl;
+    return hits == wide_hits ? 0 : 1;
+}
@@ -0,0 +1,88 @@
+// Triangle intersection throughput, scalar against the batched SIMD kernel.
+//
+// Build (pick the kernel width with the target flags, e.g. -mavx2 for 8 lanes):
+//   g++ -std=c++17 -O2 -mavx2 -Iinclude src/bench_intersect.cpp -o bench_intersect
+// Run from the repository root:
+//   ./bench_intersect [stl file] [number of rays]
+
+#include "utility.h"
+
+#include "mesh.h"
+#include "triangle.h"
+#include "triangle_simd.h"
+#include <chrono>
+#include <random>
+
+using std::chrono::steady_clock;
+
+double seconds_since(steady_clock::time_point start) {
+    return std::chrono::duration<double>(steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[]) {
+    const char* filename = argc > 1 ? argv[1] : "stl/ancient_chinese_coin.stl";
+    int num_rays = argc > 2 ? std::atoi(argv[2]) : 2000;
+
+    stl_reader::StlMesh<float, unsigned int> stl(filename);
+    triangle_store store;
+    std::vector<shared_ptr<hittable>> objects; // the original one-object-per-triangle layout
+    aabb bounds;
+    for (int i = 0; i < stl.num_tris(); i++) {
+        vec3 v0 = vectortoVec3(stl.tri_corner_coords(i, 0));
+        vec3 v1 = vectortoVec3(stl.tri_corner_coords(i, 1));
+        vec3 v2 = vectortoVec3(stl.tri_corner_coords(i, 2));
+        store.add(v0, v1, v2);
+        objects.push_back(make_shared<triangle>(v0, v1, v2, nullptr));
+        bounds.expand(v0);
+        bounds.expand(v1);
+        bounds.expand(v2);
+    }
+
+    // rays from a point source through random points of the mesh bounds
+    std::mt19937 gen(1);
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    vec3 extent = bounds.max() - bounds.min();
+    vec3 source = bounds.centroid() + vec3(0, 0, 4 * extent.length());
+    std::vector<ray> rays;
+    for (int i = 0; i < num_rays; i++) {
+        vec3 target = bounds.min() + vec3(dist(gen), dist(gen), dist(gen)) * extent;
+        rays.push_back(ray(source, target - source));
+    }
+
+    double tests = double(num_rays) * store.size();
+    cout << filename << ": " << store.size() << " triangles, " << num_rays << " rays, "
+         << triangle_batch_width << " lane kernel\n" << endl;
+
+    auto start = steady_clock::now();
+    size_t hits_virtual = 0;
+    for (const ray &r: rays) {
+        hit_record rec;
+        for (const auto &object: objects) {
+            object->hit(r, 0, infinity, rec);
+        }
+        hits_virtual += rec.t.size();
+    }
+    double time_virtual = seconds_since(start);
+
+    start = steady_clock::now();
+    size_t hits_scalar = 0;
+    for (const ray &r: rays) {
+        for (size_t i = 0; i < store.size(); i++) {
+            float t;
+            if (store.intersect(i, r, 0, infinity, t)) hits_scalar++;
+        }
+    }
+    double time_scalar = seconds_since(start);
+
+    start = steady_clock::now();
+    size_t hits_simd = 0;
+    for (const ray &r: rays) {
+        intersect_range(store, 0, store.size(), r, 0, infinity, [&](size_t, float) { hits_simd++; });
+    }
+    double time_simd = seconds_since(start);
+
+    cout << "triangle::hit (virtual)    " << tests / time_virtual / 1E6 << " M triangles/s, " << hits_virtual << " hits" << endl;
+    cout << "triangle_store::intersect  " << tests / time_scalar / 1E6 << " M triangles/s, " << hits_scalar << " hits" << endl;
+    cout << "intersect_range (batched)  " << tests / time_simd / 1E6 << " M triangles/s, " << hits_simd << " hits" << endl;
+    return 0;
+}
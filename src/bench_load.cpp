@@ -0,0 +1,51 @@
+// STL load time, the streaming readers against the memory-mapped parallel ones (binary or ASCII).
+//
+// Build:
+//   g++ -std=c++17 -O2 -pthread -Iinclude src/bench_load.cpp -o bench_load
+// Run from the repository root:
+//   ./bench_load [stl file] [threads, 0 for all]
+
+#include "stl_reader.h"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+using std::chrono::steady_clock;
+
+double seconds_since(steady_clock::time_point start) {
+    return std::chrono::duration<double>(steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[]) {
+    const char* filename = argc > 1 ? argv[1] : "stl/ancient_chinese_coin.stl";
+    unsigned int threads = argc > 2 ? std::atoi(argv[2]) : 0;
+    bool ascii = stl_reader::StlFileHasASCIIFormat(filename);
+
+    std::vector<float> coords, normals, mapped_coords, mapped_normals;
+    std::vector<unsigned int> tris, solids, mapped_tris, mapped_solids;
+
+    auto start = steady_clock::now();
+    if (ascii) stl_reader::ReadStlFile_ASCII(filename, coords, normals, tris, solids);
+    else stl_reader::ReadStlFile_BINARY(filename, coords, normals, tris, solids);
+    double stream_time = seconds_since(start);
+
+    start = steady_clock::now();
+    if (ascii) stl_reader::ReadStlFile_ASCII_MAPPED(filename, mapped_coords, mapped_normals, mapped_tris, mapped_solids,
+                                                    threads);
+    else stl_reader::ReadStlFile_BINARY_MAPPED(filename, mapped_coords, mapped_normals, mapped_tris, mapped_solids,
+                                               threads);
+    double mapped_time = seconds_since(start);
+
+    // vertex order differs (sorted against first appearance), the triangle corners must not
+    bool same = tris.size() == mapped_tris.size() && coords.size() == mapped_coords.size();
+    for (size_t i = 0; same && i < tris.size(); i++) {
+        for (int k = 0; k < 3; k++) same = same && coords[3 * tris[i] + k] == mapped_coords[3 * mapped_tris[i] + k];
+    }
+
+    std::cout << filename << (ascii ? " (ASCII): " : " (binary): ") << tris.size() / 3 << " triangles, "
+              << coords.size() / 3 << " vertices\n"
+              << "stream: " << stream_time << " s\n"
+              << "mapped: " << mapped_time << " s (" << stream_time / mapped_time << "x)\n"
+              << (same ? "same mesh" : "MESHES DIFFER") << std::endl;
+    return same ? 0 : 1;
+}
@@ -1,10 +1,13 @@
 #include "utility.h"
 
 #include "color.h"
-#include "hittable_list.h"
-#include "sphere.h"
-#include "mesh.h"
+#include "scene.h"
 #include "camera.h"
+#include "framebuffer.h"
+#include "renderer.h"
+#include "spectrum.h"
+#include "image_writer.h"
+#include "sweep.h"
 #include <string>
 #include <fstream>
 
@@ -12,16 +15,6 @@ using nlohmann::json;
 
 #include <iostream>
 
-float ray_intensity(const ray& r, const hittable& world) {
-    hit_record rec;
-      if (world.hit(r, 0, infinity, rec)) {
-            return rec.trans_prob; // if hit, return the probability of transmission
-        }
-      else {
-          return 1; // if not hit, return 1 (vacuum)
-      }
-}
-
 
 int main(int argc, char *argv[]) {
 
@@ -55,35 +48,100 @@ int main(int argc, char *argv[]) {
     int viewport_height = viewport_width / aspect_ratio;
     int focal_length = config["viewport"]["focal_length"].get<float>();
 
+    // Render settings, 0 threads uses every core
+    json render_config = config.value("render", json::object());
+    int threads = render_config.value("threads", 0);
+    int tile_size = render_config.value("tile_size", 32);
+    int packet_size = render_config.value("packet_size", 8); // pixels per side of a ray packet, 1 traces single rays
+    antialiasing pixel_area(render_config.value("antialiasing", json::object())); // one ray per pixel unless given
+    bvh::set_build_threads(threads); // mesh BVHs are built on the render threads too
+
+    // Output formats, a single name or a list of them
+    json output_config = config.value("output", json::object());
+    json format_config = output_config.value("format", json("png"));
+    std::vector<string> output_formats;
+    if (format_config.is_array()) output_formats = format_config.get<std::vector<string>>();
+    else output_formats.push_back(format_config.get<string>());
+    for (const string &format: output_formats) {
+        if (!image_writer::is_format(format)) {
+            cout << "Unknown output format " << format << ", expected pgm, pgm16, png, png16, npy or tiff" << endl;
+            return 1;
+        }
+        for (const string &other: output_formats) {
+            if (&other != &format && image_writer::extension(other) == image_writer::extension(format)) {
+                cout << "Output formats " << format << " and " << other << " would write the same file" << endl;
+                return 1;
+            }
+        }
+    }
+
+    // Material data, the attenuation tables are loaded on first use
+    json material_config = config.value("materials", json::object());
+    attenuation_database::set_path(material_config.value("attenuation_data", string("materials/nist_mu.dat")));
+
+    // Preprocessed mesh cache, written next to each STL unless a directory is given
+    json cache_config = config.value("cache", json::object());
+    mesh_cache::set_enabled(cache_config.value("meshes", true));
+    mesh_cache::set_directory(cache_config.value("directory", string("")));
+
+    // STLs are read in chunks straight into the meshes, "streaming": false reads and welds each file whole first.
+    // Meshes are traced through 4-wide BVHs with compressed nodes, "wide_bvh": false keeps the binary ones.
+    json mesh_config = config.value("meshes", json::object());
+    mesh::set_streaming(mesh_config.value("streaming", true), mesh_config.value("chunk_triangles", 1 << 16));
+    mesh::set_wide_bvh(mesh_config.value("wide_bvh", true));
+
+    // Source spectrum, without one every material uses its effective energy
+    json source_config = config.value("source", json::object());
+    spectrum source;
+    if (source_config.contains("spectrum")) {
+        source.load(source_config["spectrum"].get<string>());
+    }
+    focal_spot spot(source_config.value("focal_spot", json::object())); // a point source unless a size is given
+
 
     cout << "\n<Image Settings>" << endl;
     cout << "Image resolution: " << image_width << "x" << image_height << endl;
     cout << "Viewport dimensions: " << viewport_width << "x" << viewport_height << " cm\n" << endl;
-    camera camera(viewport_width, aspect_ratio, focal_length);
-
-    // World
-    hittable_list world; // list of objects in the world;
-    world.add(make_shared<mesh>("stl/Soda_Can.stl", vec3(0, 0, -focal_length),
-                                make_shared<material>("Al", 40))); // Plastic Container
-
-
-    // Render
-    std::ofstream render;
-    render.open(string(argv[2]) + ".pgm"); // open pgm file for writing greyscale image
-    render << "P2\n" << image_width << ' ' << image_height << "\n255\n";
-    for (int j = image_height-1; j >= 0; --j) {
-        std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
-        for (int i = 0; i < image_width; ++i) {
-            auto u = float(i) / (image_width-1);
-            auto v = float(j) / (image_height-1);
-            ray r = camera.get_ray(u, v); // ray from camera to pixel;
-            float intensity = ray_intensity(r, world);
-            write_color(render, intensity);
-        }
+    renderer renderer(threads, tile_size, packet_size);
+    cout << "Render threads: " << renderer.threads() << ", tile size: " << tile_size << ", packet size: "
+         << packet_size << "\n" << endl;
+    if (!source.empty()) renderer.set_spectrum(&source);
+    if (spot.enabled()) renderer.set_focal_spot(&spot);
+    if (pixel_area.enabled()) renderer.set_antialiasing(&pixel_area);
+
+    // Monte Carlo scatter, added to the primary image when the config has a "scatter" section
+    scatter_simulation scatter(config.value("scatter", json::object()));
+    if (config.contains("scatter")) renderer.set_scatter(&scatter);
+
+    // Detector response and processing stages, applied to every image before it is written
+    detector detector(config.value("detector", json::object()), viewport_width / float(image_width - 1));
+    if (config.contains("detector")) renderer.set_detector(&detector);
+    camera camera = scene::make_camera(config, viewport_width, aspect_ratio, focal_length);
+
+    // World, built from the scene description
+    if (!config.contains("scene")) {
+        cout << "No scene given, add a \"scene\" entry (inline or a scene file such as cfg/object_cfg.json)" << endl;
+        return 1;
+    }
+    scene scene(source);
+    scene.load(config["scene"]);
+    const hittable_list &world = scene.world;
+
+    // Render, either a single projection or a sweep of them around the scene
+    if (config.contains("sweep")) {
+        projection_sweep sweep(config["sweep"]);
+        sweep.run(renderer, camera, world, image_width, image_height, argv[2], output_formats);
+        std::cerr << "Done.\n";
+        return 0;
+    }
+
+    framebuffer image(image_width, image_height);
+    renderer.render(camera, world, image);
+
+    std::cerr << "\n";
+    for (const string &format: output_formats) {
+        image_writer::write(image, argv[2], format);
     }
-    render.close();
-    system((string("convert") + " " + argv[2] + ".pgm " + argv[2] + ".png").c_str()); // convert pgm to png
-    system((string("rm") + " " + argv[2] + ".pgm").c_str()); // remove pgm file
-    std::cerr << "\nDone.\n";
+    std::cerr << "Done.\n";
     return 0;
 }